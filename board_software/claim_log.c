@@ -0,0 +1,113 @@
+/**
+ * claim_log.c
+ * A log of recent claim attempts for the JD Beacon Board, which allows the
+ * host PC to retrieve every attempt made since it last asked, rather than
+ * only the most recent one.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <util/atomic.h>
+
+#include "timers.h"
+#include "claim_log.h"
+
+/**
+ * The log itself: a ring buffer of claim events. New events are added at
+ * the head; the oldest event is at the tail.
+ */
+static struct claim_event claim_events[CLAIM_LOG_SIZE];
+volatile static uint8_t log_head = 0;
+volatile static uint8_t log_count = 0;
+
+/**
+ * The number of events which have been discarded since the log was last drained.
+ */
+volatile static uint8_t dropped_events = 0;
+
+
+/**
+ * Adds a claim event to the log, timestamped with the current time.
+ * If the log is full, the oldest event is discarded, and counted as dropped.
+ * Safe to call from interrupt context.
+ */
+void log_claim_event(uint8_t value, uint8_t flags, uint8_t distance) {
+  log_claim_event_at(timer_ticks(), value, flags, distance);
+}
+
+
+/**
+ * Adds a claim event to the log, with the given timestamp.
+ */
+void log_claim_event_at(uint32_t timestamp, uint8_t value, uint8_t flags, uint8_t distance) {
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    struct claim_event *event = &claim_events[log_head];
+
+    event->timestamp = timestamp;
+    event->value = value;
+    event->flags = flags;
+    event->distance = distance;
+
+    log_head = (log_head + 1) & (CLAIM_LOG_SIZE - 1);
+
+    //If we've just overwritten the oldest event, count it as lost.
+    if(log_count == CLAIM_LOG_SIZE) {
+      if(dropped_events != 0xFF) {
+        ++dropped_events;
+      }
+    } else {
+      ++log_count;
+    }
+  }
+}
+
+
+/**
+ * Removes up to the given number of events from the log, oldest first.
+ */
+uint8_t drain_claim_log(struct claim_event *events, uint8_t maximum, uint8_t *dropped) {
+
+  uint8_t count;
+  uint8_t i;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    uint8_t tail = (log_head - log_count) & (CLAIM_LOG_SIZE - 1);
+
+    count = (log_count < maximum) ? log_count : maximum;
+
+    for(i = 0; i < count; ++i) {
+      events[i] = claim_events[(tail + i) & (CLAIM_LOG_SIZE - 1)];
+    }
+
+    log_count -= count;
+
+    *dropped = dropped_events;
+    dropped_events = 0;
+  }
+
+  return count;
+}
@@ -0,0 +1,93 @@
+/**
+ * claim_log.h
+ * A log of recent claim attempts for the JD Beacon Board, which allows the
+ * host PC to retrieve every attempt made since it last asked, rather than
+ * only the most recent one.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __CLAIM_LOG_H__
+#define __CLAIM_LOG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The number of claim events which the log can hold. Must be a power of two.
+ */
+#define CLAIM_LOG_SIZE 16
+
+/**
+ * Flags which describe a claim event.
+ */
+#define CLAIM_EVENT_FRAMING_ERROR (1 << 0)
+#define CLAIM_EVENT_ACCEPTED      (1 << 1)
+#define CLAIM_EVENT_THROTTLED     (1 << 2)
+
+/**
+ * Data structure which represents a single claim attempt.
+ */
+struct claim_event {
+
+  // The time at which the attempt was received, in timer ticks (see timers.h).
+  uint32_t timestamp;
+
+  // The byte which was received.
+  uint8_t value;
+
+  // Any of the CLAIM_EVENT flags which apply to this attempt.
+  uint8_t flags;
+
+  // The number of bits by which the value differed from the expected response.
+  uint8_t distance;
+
+};
+
+/**
+ * Adds a claim event to the log, timestamped with the current time.
+ * If the log is full, the oldest event is discarded, and counted as dropped.
+ * Safe to call from interrupt context.
+ */
+void log_claim_event(uint8_t value, uint8_t flags, uint8_t distance);
+
+/**
+ * Adds a claim event to the log, as log_claim_event, but with the given
+ * timestamp (in timer ticks); e.g. the time the attempt arrived, for an
+ * attempt which is only judged later, from the main loop.
+ */
+void log_claim_event_at(uint32_t timestamp, uint8_t value, uint8_t flags, uint8_t distance);
+
+/**
+ * Removes up to the given number of events from the log, oldest first.
+ *
+ * events: Buffer which receives the events.
+ * dropped: Receives the number of events which have been discarded since the
+ *    log was last drained, saturating at 255.
+ *
+ * Returns the number of events removed.
+ */
+uint8_t drain_claim_log(struct claim_event *events, uint8_t maximum, uint8_t *dropped);
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * claim_validator.c
+ * Judges responses to the beacon's claim codes. A response to any of the
+ * most recently transmitted codes is accepted, so a robot which answers
+ * just after the beacon moves on to a new code isn't penalized; and the
+ * rate of attempts is limited, so the codes can't be guessed by brute force.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "claim_validator.h"
+#include "timers.h"
+
+/**
+ * The number of set bits in each possible byte.
+ */
+static const uint8_t popcount_table[256] PROGMEM = {
+  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+  4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
+};
+
+/**
+ * The remembered claim codes, newest first from the window's head; and,
+ * for each code, the time at which it was replaced by a newer one.
+ */
+static volatile uint8_t window_codes[CLAIM_WINDOW_MAXIMUM_SIZE];
+static volatile uint32_t window_replaced_at[CLAIM_WINDOW_MAXIMUM_SIZE];
+static volatile uint8_t window_head = 0, window_count = 0;
+
+/**
+ * The number of codes which are accepted (including the current one), and
+ * how long a replaced code remains acceptable, in ticks. By default, the
+ * previous code is accepted for a quarter second after it's replaced.
+ */
+static volatile uint8_t window_size = 2;
+static volatile uint32_t grace_period = TIMER_TICKS_PER_SECOND / 4;
+
+/**
+ * The claim attempt bucket. Rather than whole tokens, the bucket holds
+ * "credits": each tick adds claim_rate credits, and each attempt costs
+ * CREDITS_PER_TOKEN, so the bucket refills at claim_rate tokens per second.
+ * By default, a robot can make three quick attempts, and then two more
+ * every second.
+ */
+#define CREDITS_PER_TOKEN ((uint32_t)TIMER_TICKS_PER_SECOND)
+static volatile uint8_t claim_rate = 2, claim_burst = 3;
+static volatile uint32_t claim_credits = 3 * CREDITS_PER_TOKEN;
+static volatile uint32_t credits_updated_at = 0;
+
+
+/**
+ * Forgets all of the remembered claim codes.
+ */
+void clear_claim_window() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    window_count = 0;
+  }
+}
+
+/**
+ * Remembers a newly transmitted claim code, which replaces the previous code.
+ */
+void record_claim_code(uint8_t code) {
+
+  uint32_t now = timer_ticks();
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    //The current code (if there is one) has just been replaced...
+    window_replaced_at[window_head] = now;
+
+    //... by the new code, which takes the place of the oldest.
+    window_head = (window_head + 1) & (CLAIM_WINDOW_MAXIMUM_SIZE - 1);
+    window_codes[window_head] = code;
+
+    if(window_count < CLAIM_WINDOW_MAXIMUM_SIZE) {
+      ++window_count;
+    }
+  }
+}
+
+/**
+ * Returns the smallest hamming distance between the given response and the
+ * expected response to any of the claim codes in the window.
+ */
+uint8_t claim_response_distance(uint8_t response) {
+
+  uint32_t now = timer_ticks();
+  uint8_t distance, best = NO_CLAIM_CODE_DISTANCE;
+  uint8_t i, index, count;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    count = (window_count < window_size) ? window_count : window_size;
+    index = window_head;
+
+    for(i = 0; i < count; ++i) {
+
+      //Codes are visited newest first, so once one has been replaced for
+      //longer than the grace period, so have all of the remaining codes.
+      if(i && (now - window_replaced_at[index]) > grace_period) {
+        break;
+      }
+
+      //The expected response is the inverse of the code.
+      distance = hamming_distance(response, ~window_codes[index]);
+      if(distance < best) {
+        best = distance;
+      }
+
+      index = (index - 1) & (CLAIM_WINDOW_MAXIMUM_SIZE - 1);
+    }
+  }
+
+  return best;
+}
+
+/**
+ * Sets the number of codes in the window, including the current one.
+ */
+uint8_t set_claim_window_size(uint8_t size) {
+
+  if(size < 1) {
+    size = 1;
+  } else if(size > CLAIM_WINDOW_MAXIMUM_SIZE) {
+    size = CLAIM_WINDOW_MAXIMUM_SIZE;
+  }
+
+  window_size = size;
+  return size;
+}
+
+/**
+ * Sets how long a code continues to be accepted after it's been replaced.
+ */
+void set_claim_grace_period(uint32_t ticks) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    grace_period = ticks;
+  }
+}
+
+/**
+ * Takes a token from the claim attempt bucket, if there's one available.
+ */
+bool take_claim_token() {
+
+  uint32_t now = timer_ticks();
+  uint32_t elapsed, capacity;
+  bool available;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    //Add the credits earned since we last looked. Once the bucket's been
+    //idle long enough to fill, any further time doesn't matter; capping
+    //the time here also keeps the multiplication from overflowing.
+    capacity = claim_burst * CREDITS_PER_TOKEN;
+    elapsed = now - credits_updated_at;
+    credits_updated_at = now;
+
+    if(elapsed > capacity) {
+      elapsed = capacity;
+    }
+
+    claim_credits += elapsed * claim_rate;
+    if(claim_credits > capacity) {
+      claim_credits = capacity;
+    }
+
+    //Spend a token's worth of credits, if we have them.
+    available = (claim_credits >= CREDITS_PER_TOKEN);
+    if(available) {
+      claim_credits -= CREDITS_PER_TOKEN;
+    }
+  }
+
+  return available;
+}
+
+/**
+ * Fills the claim attempt bucket.
+ */
+void refill_claim_tokens() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    claim_credits = claim_burst * CREDITS_PER_TOKEN;
+  }
+}
+
+/**
+ * Sets the rate at which claim attempts are allowed, in attempts per second.
+ */
+uint8_t set_claim_rate(uint8_t attempts_per_second) {
+  claim_rate = attempts_per_second ? attempts_per_second : 1;
+  return claim_rate;
+}
+
+/**
+ * Sets the number of claim attempts which can be made in quick succession.
+ */
+uint8_t set_claim_burst(uint8_t attempts) {
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    claim_burst = attempts ? attempts : 1;
+
+    //Don't let the bucket hold more than its new size.
+    if(claim_credits > claim_burst * CREDITS_PER_TOKEN) {
+      claim_credits = claim_burst * CREDITS_PER_TOKEN;
+    }
+  }
+
+  return claim_burst;
+}
+
+/**
+ * Returns the number of bits which differ between two bytes.
+ */
+uint8_t hamming_distance(uint8_t a, uint8_t b) {
+  return pgm_read_byte(&popcount_table[a ^ b]);
+}
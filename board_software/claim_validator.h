@@ -0,0 +1,113 @@
+/**
+ * claim_validator.h
+ * Judges responses to the beacon's claim codes. A response to any of the
+ * most recently transmitted codes is accepted, so a robot which answers
+ * just after the beacon moves on to a new code isn't penalized; and the
+ * rate of attempts is limited, so the codes can't be guessed by brute force.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __CLAIM_VALIDATOR_H__
+#define __CLAIM_VALIDATOR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The most claim codes which can be remembered. Must be a power of two.
+ */
+#define CLAIM_WINDOW_MAXIMUM_SIZE 8
+
+/**
+ * The distance reported when there are no claim codes to compare against.
+ */
+#define NO_CLAIM_CODE_DISTANCE 0xFF
+
+/**
+ * Forgets all of the remembered claim codes.
+ */
+void clear_claim_window();
+
+/**
+ * Remembers a newly transmitted claim code, which replaces the previous code
+ * as the current one. Safe to call from interrupt context.
+ */
+void record_claim_code(uint8_t code);
+
+/**
+ * Returns the smallest hamming distance between the given response and the
+ * expected response (the inverse) of any of the claim codes in the window:
+ * the current code, and any of the previous (window size - 1) codes which
+ * were replaced no longer ago than the grace period. Returns
+ * NO_CLAIM_CODE_DISTANCE if there are no such codes. Safe to call from
+ * interrupt context.
+ */
+uint8_t claim_response_distance(uint8_t response);
+
+/**
+ * Sets the number of codes in the window, including the current one; this
+ * is clamped to between 1 and CLAIM_WINDOW_MAXIMUM_SIZE. Returns the size
+ * which was applied.
+ */
+uint8_t set_claim_window_size(uint8_t size);
+
+/**
+ * Sets how long a code continues to be accepted after it's been replaced,
+ * in timer ticks.
+ */
+void set_claim_grace_period(uint32_t ticks);
+
+/**
+ * Takes a token from the claim attempt "bucket", which allows a single
+ * claim attempt to be judged. The bucket holds up to the burst size in
+ * tokens, and is refilled at the configured rate. Returns false if the
+ * bucket is empty, in which case the attempt should be throttled.
+ * Safe to call from interrupt context.
+ */
+bool take_claim_token();
+
+/**
+ * Fills the claim attempt bucket, e.g. at the start of a round.
+ */
+void refill_claim_tokens();
+
+/**
+ * Sets the rate at which claim attempts are allowed, in attempts per
+ * second; this is clamped to at least one. Returns the rate applied.
+ */
+uint8_t set_claim_rate(uint8_t attempts_per_second);
+
+/**
+ * Sets the number of claim attempts which can be made in quick succession;
+ * this is clamped to at least one. Returns the burst size applied.
+ */
+uint8_t set_claim_burst(uint8_t attempts);
+
+/**
+ * Returns the number of bits which differ between two bytes.
+ */
+uint8_t hamming_distance(uint8_t a, uint8_t b);
+
+#endif
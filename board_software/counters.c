@@ -0,0 +1,65 @@
+/**
+ * counters.c
+ * Performance counters for the JD Beacon Board, which track how often
+ * notable events occur, so the host PC can monitor a board's health.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "counters.h"
+
+volatile uint16_t performance_counters[PERFORMANCE_COUNTER_COUNT];
+
+
+/**
+ * Copies each of the counters into the given buffer (which must have room
+ * for PERFORMANCE_COUNTER_COUNT values) and clears them, atomically.
+ */
+void read_and_clear_counters(uint16_t *values) {
+
+  uint8_t i;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(i = 0; i < PERFORMANCE_COUNTER_COUNT; ++i) {
+      values[i] = performance_counters[i];
+      performance_counters[i] = 0;
+    }
+  }
+}
+
+
+/**
+ * Copies each of the counters into the given buffer (which must have room
+ * for PERFORMANCE_COUNTER_COUNT values) atomically, leaving them running.
+ */
+void read_counters(uint16_t *values) {
+
+  uint8_t i;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(i = 0; i < PERFORMANCE_COUNTER_COUNT; ++i) {
+      values[i] = performance_counters[i];
+    }
+  }
+}
@@ -0,0 +1,83 @@
+/**
+ * counters.h
+ * Performance counters for the JD Beacon Board, which track how often
+ * notable events occur, so the host PC can monitor a board's health.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include <stdint.h>
+#include <util/atomic.h>
+
+/**
+ * Each of the events which are counted. The host PC receives the counters
+ * in this order, so new counters should only be added at the end.
+ */
+enum performance_counter {
+  COUNTER_IR_BYTES_RECEIVED = 0,
+  COUNTER_IR_FRAMING_ERRORS,
+  COUNTER_VALID_CLAIMS,
+  COUNTER_REJECTED_CLAIMS,
+  COUNTER_IR_TRANSMISSIONS,
+  COUNTER_USB_TIMEOUTS,       //No longer counted: USB output never waits.
+  COUNTER_WORK_OVERRUNS,
+  COUNTER_THROTTLED_CLAIMS,
+  COUNTER_IR_ECHOES,
+  COUNTER_USB_OVERFLOWS,
+  PERFORMANCE_COUNTER_COUNT
+};
+
+/**
+ * The counters themselves. These should only be accessed via the functions below.
+ */
+extern volatile uint16_t performance_counters[PERFORMANCE_COUNTER_COUNT];
+
+/**
+ * Counts a single occurrence of the given event. Counters saturate, rather
+ * than wrapping. Safe (and cheap) to call from interrupt context.
+ */
+static inline void count_event(enum performance_counter counter) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if(performance_counters[counter] != 0xFFFF) {
+      ++performance_counters[counter];
+    }
+  }
+}
+
+/**
+ * Copies each of the counters into the given buffer (which must have room
+ * for PERFORMANCE_COUNTER_COUNT values) and clears them, atomically.
+ */
+void read_and_clear_counters(uint16_t *values);
+
+/**
+ * Copies each of the counters into the given buffer (which must have room
+ * for PERFORMANCE_COUNTER_COUNT values) atomically, leaving them running.
+ */
+void read_counters(uint16_t *values);
+
+#endif
@@ -23,9 +23,32 @@
  * THE SOFTWARE.
  */
 
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdbool.h>
+
 #include "debug.h"
+#include "timers.h"
+
+static int debug_put_char(char character, FILE *stream);
+
+//The stream which carries stdout over the trace, once it's been enabled.
+static FILE *spi_debug_channel = NULL;
+
+//Ring buffer which holds trace records until the SPI port can send them.
+static volatile uint8_t trace_buffer[TRACE_BUFFER_SIZE];
+static volatile uint8_t trace_head = 0, trace_tail = 0;
+
+//True iff the SPI port is currently sending a byte; the transfer
+//complete interrupt then sends the next.
+static volatile bool trace_transmitting = false;
+
+//The number of records dropped since we were last able to report it.
+static volatile uint8_t dropped_records = 0;
+
+//The high half of the tick count, as of the most recent TRACE_EPOCH record.
+static volatile uint16_t trace_epoch = 0;
 
-FILE spi_debug_channel = FDEV_SETUP_STREAM(debug_put_byte_blocking, NULL, _FDEV_SETUP_RW); 
 
 /**
  * Enables the debug backend, which communicates debug information
@@ -40,49 +63,148 @@ void enable_debug_backend() {
   //Ensure that the "slave select" line always reads high.
   SPI_PORT |= (1 << SS_PIN);
 
-  //Enable SPI at 1MHz, the maximum frequency allowed by the Bus
-  //Pirate (and our transmission lines!)
-  SPCR = (1 << SPE) | (1 << MSTR) | (1 << SPR1);
+  //Enable SPI at 250kHz, well within the limits of the Bus Pirate
+  //(and our transmission lines!). Each completed byte raises an
+  //interrupt, which sends the next queued byte.
+  SPCR = (1 << SPIE) | (1 << SPE) | (1 << MSTR) | (1 << SPR1);
+
+  //The trace's timestamps are based on the system tick.
+  set_up_timers();
 
   //Enable stdout over SPI, which allows the "printf" function
   //to be used to exchange debug information.
-  //WARNING: Printf is blocking-- the whole microcontroller will
-  //grind to a halt during transmission!
   enable_stdout_over_spi();
 
 }
 
 /**
  * Enables the use of the standard output functions (e.g. printf
- * and friends) to exchange debugging information. Be warned: the
- * AVR's implementation of these is blocking, and will grind the
- * whole microcontroller to a halt!
+ * and friends) to exchange debugging information.
  */
 void enable_stdout_over_spi() {
-  stdout = &spi_debug_channel;
+
+  if(!spi_debug_channel) {
+    spi_debug_channel = fdevopen(debug_put_char, NULL);
+  }
+
+  stdout = spi_debug_channel;
+}
+
+/**
+ * Writes a single character to the debug output, as a trace record.
+ */
+static int debug_put_char(char character, FILE *stream) {
+  trace_event(TRACE_TEXT, character);
+  return 0;
+}
+
+/**
+ * Returns the amount of free space in the trace buffer, in bytes.
+ * Must be called with interrupts disabled.
+ */
+static inline uint8_t trace_buffer_space() {
+  return (trace_tail - trace_head - 1) & (TRACE_BUFFER_SIZE - 1);
+}
+
+/**
+ * Adds a single byte to the trace buffer, which must have room for it.
+ * Must be called with interrupts disabled.
+ */
+static inline void trace_buffer_put(uint8_t byte) {
+  trace_buffer[trace_head] = byte;
+  trace_head = (trace_head + 1) & (TRACE_BUFFER_SIZE - 1);
 }
 
 /**
- * Put a single byte of data onto the system's debug output;
- * but does not block.
+ * Adds a complete record to the trace buffer, which must have room for it.
+ * Must be called with interrupts disabled.
  */
-inline void debug_put_byte(uint8_t byte) {
-  SPDR = byte;
+static void trace_buffer_put_record(uint8_t header, uint16_t timestamp, uint8_t first_argument, uint8_t second_argument) {
+  trace_buffer_put(header);
+  trace_buffer_put(timestamp >> 8);
+  trace_buffer_put(timestamp & 0xFF);
+  trace_buffer_put(first_argument);
+
+  if(header & TRACE_TWO_ARGUMENTS) {
+    trace_buffer_put(second_argument);
+  }
 }
 
 /**
- * Blocks until the debug line has finished transmitting the
- * current byte.
- */ 
-inline void wait_for_debug_ready() {
-  while(!(SPSR & (1<<SPIF)));
+ * Starts sending the contents of the trace buffer, if we're not already.
+ * Must be called with interrupts disabled.
+ */
+static inline void start_trace_transmission() {
+  if(!trace_transmitting && trace_head != trace_tail) {
+    trace_transmitting = true;
+    SPDR = trace_buffer[trace_tail];
+    trace_tail = (trace_tail + 1) & (TRACE_BUFFER_SIZE - 1);
+  }
 }
 
 /**
- * Put a single byte of data onto the system's debug output;
- * and blocks until the transmit is complete.
+ * Queues a trace record for transmission, along with any housekeeping
+ * records which need to precede it.
+ */
+static void queue_trace_record(uint8_t header, uint8_t first_argument, uint8_t second_argument) {
+
+  uint32_t ticks = timer_ticks();
+  uint16_t epoch = ticks >> 16;
+  uint8_t needed = (header & TRACE_TWO_ARGUMENTS) ? 5 : 4;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    //Work out which housekeeping records we owe the decoder.
+    if(epoch != trace_epoch) {
+      needed += 5;
+    }
+    if(dropped_records) {
+      needed += 4;
+    }
+
+    //If there's no room for everything, drop this record...
+    if(trace_buffer_space() < needed) {
+      if(dropped_records != 0xFF) {
+        ++dropped_records;
+      }
+    }
+    //... otherwise, queue it, after any housekeeping.
+    else {
+      if(epoch != trace_epoch) {
+        trace_epoch = epoch;
+        trace_buffer_put_record(TRACE_EPOCH | TRACE_TWO_ARGUMENTS, ticks, epoch >> 8, epoch & 0xFF);
+      }
+      if(dropped_records) {
+        trace_buffer_put_record(TRACE_DROPPED, ticks, dropped_records, 0);
+        dropped_records = 0;
+      }
+      trace_buffer_put_record(header, ticks, first_argument, second_argument);
+
+      start_trace_transmission();
+    }
+  }
+}
+
+/**
+ * Queues a trace record with a single argument for transmission.
+ */
+void trace_event(uint8_t event, uint8_t argument) {
+  queue_trace_record(event, argument, 0);
+}
+
+/**
+ * Queues a trace record with two arguments for transmission.
+ */
+void trace_event2(uint8_t event, uint8_t first_argument, uint8_t second_argument) {
+  queue_trace_record(event | TRACE_TWO_ARGUMENTS, first_argument, second_argument);
+}
+
+
+/**
+ * Interrupt handler which is executed whenever the SPI port has finished
+ * sending a byte; sends the next byte of the trace, if there is one.
  */
-void debug_put_byte_blocking(uint8_t byte) {
-  debug_put_byte(byte);
-  wait_for_debug_ready();
+ISR(SPI_STC_vect) {
+  trace_transmitting = false;
+  start_trace_transmission();
 }
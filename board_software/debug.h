@@ -23,7 +23,6 @@
  * THE SOFTWARE.
  */
 
-
 #ifndef __DEBUG_H__
 #define __DEBUG_H__
 
@@ -41,6 +40,51 @@
 #define SCK_PIN  PB1
 #define MOSI_PIN PB2 
 
+/**
+ * The size of the buffer which holds trace records until they can be
+ * transmitted. Must be a power of two, no larger than 256.
+ */
+#define TRACE_BUFFER_SIZE 128
+
+/**
+ * Trace records are sent over SPI in a compact binary format:
+ *
+ *  - One byte, containing the event's ID (below) in its low seven bits.
+ *    The top bit is set if the record carries two arguments, rather than one.
+ *  - Two bytes (most significant first) containing the low half of the
+ *    timer tick count (see timers.h) at which the event occurred.
+ *  - One or two argument bytes, whose meaning depends on the event.
+ *
+ * Whenever the high half of the tick count changes, a TRACE_EPOCH record
+ * is sent first, so the decoder can always recover the full timestamp.
+ * See host/trace_decode.c, which turns a captured trace into a timeline.
+ */
+#define TRACE_TWO_ARGUMENTS 0x80
+
+/**
+ * Each of the events which can be traced. The decoder relies on these
+ * values, so new events should only be added at the end.
+ */
+enum trace_event_id {
+
+  // Housekeeping records, generated by the trace channel itself.
+  TRACE_EPOCH = 1,          // (high byte, low byte) of the tick count's high half
+  TRACE_DROPPED,            // (count) records lost because the buffer was full
+  TRACE_TEXT,               // (character) written to stdout
+
+  // Events generated by the beacon.
+  TRACE_PC_REQUEST,         // (request) received from the PC
+  TRACE_STATE_CHANGE,       // (raw state) applied
+  TRACE_IR_TRANSMIT,        // (value) sent as a claim code
+  TRACE_IR_RECEIVE,         // (value, hamming distance from the expected response)
+  TRACE_IR_FRAMING_ERROR,   // (value) received with a framing error
+  TRACE_CLAIM_ACCEPTED,     // (value, owner)
+  TRACE_CLAIM_REJECTED,     // (value)
+  TRACE_CLAIM_THROTTLED,    // (value) received while claim attempts were rate limited
+
+  TRACE_EVENT_COUNT
+};
+
 
 /**
  * Enables the debug backend, which communicates debug information
@@ -51,28 +95,38 @@ void enable_debug_backend();
 
 /**
  * Enables the use of the standard output functions (e.g. printf
- * and friends) to exchange debugging information. Be warned: the
- * AVR's implementation of these is blocking, and will grind the
- * whole microcontroller to a halt!
+ * and friends) to exchange debugging information. Output is queued,
+ * one TRACE_TEXT record per character, rather than sent immediately;
+ * so formatting still takes time, but no longer waits on the SPI port.
  */
 void enable_stdout_over_spi();
 
 /**
- * Put a single byte of data onto the system's debug output;
- * but does not block.
+ * Queues a trace record with a single argument for transmission.
+ * Never blocks; if there's no room for the record, it's dropped (and
+ * counted). Safe to call from interrupt context.
  */
-inline void debug_put_byte(uint8_t byte);
+void trace_event(uint8_t event, uint8_t argument);
 
 /**
- * Blocks until the debug line has finished transmitting the
- * current byte.
- */ 
-inline void wait_for_debug_ready();
+ * Queues a trace record with two arguments for transmission.
+ * Never blocks; if there's no room for the record, it's dropped (and
+ * counted). Safe to call from interrupt context.
+ */
+void trace_event2(uint8_t event, uint8_t first_argument, uint8_t second_argument);
+
 
 /**
- * Put a single byte of data onto the system's debug output;
- * and blocks until the transmit is complete.
+ * Tracing macros, which allow trace points to be left in place at no cost:
+ * they only generate code when the firmware is built with TRACING defined
+ * (e.g. "make TRACING=1").
  */
-inline void debug_put_byte_blocking(uint8_t byte);
+#ifdef TRACING
+#define TRACE(event, argument) trace_event(event, argument)
+#define TRACE2(event, first, second) trace_event2(event, first, second)
+#else
+#define TRACE(event, argument)
+#define TRACE2(event, first, second)
+#endif
 
 #endif
@@ -0,0 +1,831 @@
+/**
+ * hal.c
+ * Simulated peripherals for the host-native ("virtual beacon") build.
+ *
+ * The firmware's registers are ordinary globals (see include/avr/io.h);
+ * this module keeps a virtual clock, and emulates the peripherals the
+ * beacon relies on -- Timer 1, USART 1 and the USB start-of-frame -- by
+ * reading those registers and calling the firmware's interrupt handlers
+ * at the appropriate virtual times. The IR channel is carried over a
+ * pseudo-terminal, so external software can play the part of a robot.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "hal.h"
+
+//
+// The simulated register file.
+//
+volatile uint8_t SREG, CLKPR;
+
+volatile uint8_t DDRB, PORTB, PINB;
+volatile uint8_t DDRC, PORTC, PINC;
+volatile uint8_t DDRD, PORTD, PIND;
+volatile uint8_t DDRE, PORTE, PINE;
+volatile uint8_t DDRF, PORTF, PINF;
+
+volatile uint8_t TCCR0A, TCCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCNT0, OCR0A, OCR0B;
+
+volatile uint8_t  TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A, OCR1B, OCR1C, ICR1;
+
+volatile uint8_t  TCCR3A, TCCR3B, TCCR3C, TIMSK3, TIFR3;
+volatile uint16_t TCNT3, OCR3A, OCR3B, OCR3C, ICR3;
+
+volatile uint8_t  TCCR4A, TCCR4B, TCCR4C, TCCR4D;
+volatile uint8_t  TCNT4, TC4H, OCR4C;
+
+volatile uint8_t  UCSR1A, UCSR1B, UCSR1C;
+volatile uint16_t UBRR1;
+volatile uint16_t UDR1 = 0x100;
+
+volatile uint8_t  SPCR, SPSR;
+volatile uint16_t SPDR = 0x100;
+
+//
+// Default (empty) handlers for any vectors the firmware doesn't implement.
+//
+void __attribute__((weak)) TIMER0_COMPA_vect(void) {}
+void __attribute__((weak)) TIMER0_COMPB_vect(void) {}
+void __attribute__((weak)) TIMER1_COMPA_vect(void) {}
+void __attribute__((weak)) TIMER1_COMPB_vect(void) {}
+void __attribute__((weak)) TIMER1_COMPC_vect(void) {}
+void __attribute__((weak)) TIMER1_OVF_vect(void) {}
+void __attribute__((weak)) USART1_RX_vect(void) {}
+void __attribute__((weak)) USART1_TX_vect(void) {}
+void __attribute__((weak)) SPI_STC_vect(void) {}
+
+/**
+ * The "idle" flag for UDR1 and SPDR; any value at or above this one cannot
+ * have been written by the firmware. See include/avr/io.h.
+ */
+static const uint16_t udr_idle = 0x100;
+
+/**
+ * The number of virtual cycles advanced on each pump in free-running mode
+ * (one millisecond), and the most virtual time that a single pump may cover.
+ */
+static const uint64_t free_run_quantum = F_CPU / 1000UL;
+static const uint64_t maximum_pump_quantum = F_CPU / 64UL;
+
+/**
+ * Maps each of the timer clock-select values to its prescaler;
+ * zero indicates that the timer is stopped (or externally clocked).
+ */
+static const uint16_t timer_prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+static struct hal_options options;
+static struct timespec start_time;
+
+/**
+ * The current virtual time, in CPU cycles.
+ */
+static uint64_t now = 0;
+
+/**
+ * Simulated timer state: the virtual time at which each counter last wrapped,
+ * and whether each counter is currently running. Timer 1 also tracks whether
+ * its compare C match has already occurred in the current period.
+ */
+static uint64_t timer0_base = 0, timer1_base = 0;
+static bool timer0_running = false, timer1_running = false;
+static bool timer1_compare_c_done = false;
+
+/**
+ * The virtual time of the next USB start-of-frame.
+ */
+static uint64_t next_start_of_frame = F_CPU / 1000UL;
+
+/**
+ * USART 1 transmitter state.
+ */
+static bool transmitting = false;
+static uint64_t transmit_complete_at = 0;
+static int16_t pending_transmit = -1;
+
+/**
+ * USART 1 receiver state: bytes received from the IR pseudo-terminal which
+ * have yet to be "clocked in", and the time at which the next one arrives.
+ */
+static uint8_t receive_fifo[64];
+static uint8_t receive_head = 0, receive_count = 0;
+static uint64_t next_receive_at = 0;
+static uint8_t last_received = 0;
+
+/**
+ * SPI state: whether a byte is being shifted out, and when it'll be done.
+ */
+static bool spi_transferring = false;
+static uint64_t spi_complete_at = 0;
+
+/**
+ * Maps each of the SPI clock rate selections (SPR1:0) to its clock divider.
+ */
+static const uint8_t spi_dividers[4] = { 4, 16, 64, 128 };
+
+/**
+ * The file which receives every byte sent over SPI, if any.
+ */
+static FILE *spi_capture = NULL;
+
+/**
+ * Pseudo-terminals for the IR and USB channels.
+ */
+static int ir_fd = -1;
+static int usb_fd = -1;
+
+
+/**
+ * Returns the Timer4 interrupt flag register. Timer4 is never run in the
+ * simulator, so its flags are cleared on every access; writes (which
+ * would clear flags on the real hardware) are simply discarded.
+ */
+volatile uint8_t *hal_timer4_interrupt_flags(void) {
+  static volatile uint8_t flags;
+  flags = 0;
+  return &flags;
+}
+
+
+/**
+ * A stream created by fdevopen: the function which writes each character,
+ * and the stream itself, which is passed back to that function.
+ */
+struct device_stream {
+  int (*put)(char, FILE *);
+  FILE *stream;
+};
+
+/**
+ * Writes to an fdevopen stream, a character at a time.
+ */
+static ssize_t write_device_stream(void *cookie, const char *buffer, size_t size) {
+
+  struct device_stream *device = cookie;
+  size_t i;
+
+  for(i = 0; i < size; ++i) {
+    if(device->put(buffer[i], device->stream)) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+/**
+ * Creates a stream which calls the given function to write each character,
+ * as avr-libc's fdevopen does. As on the AVR, the first stream created
+ * for writing becomes stdout (and stderr).
+ */
+FILE *fdevopen(int (*put)(char, FILE *), int (*get)(FILE *)) {
+
+  static bool opened_for_writing = false;
+  cookie_io_functions_t functions = { .write = write_device_stream };
+  struct device_stream *device;
+
+  if(!put || !(device = malloc(sizeof(*device)))) {
+    return NULL;
+  }
+
+  device->put = put;
+  device->stream = fopencookie(device, "w", functions);
+  if(!device->stream) {
+    free(device);
+    return NULL;
+  }
+
+  //Pass each character through as soon as it's written, as the AVR does.
+  setvbuf(device->stream, NULL, _IONBF, 0);
+
+  if(!opened_for_writing) {
+    opened_for_writing = true;
+    stdout = stderr = device->stream;
+  }
+
+  return device->stream;
+}
+
+
+/**
+ * Creates a pseudo-terminal pair in raw mode, and returns the (non-blocking)
+ * master side. The slave side is held open, so the master never reports
+ * a hang-up when a client disconnects.
+ *
+ * role: A short description of the terminal, used in the startup banner.
+ * link: If non-null, the path of a symbolic link to create to the slave.
+ */
+static int open_pty(const char *role, const char *link) {
+
+  struct termios settings;
+  const char *name;
+  int master, slave;
+
+  //Create the pseudo-terminal pair...
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master < 0 || grantpt(master) || unlockpt(master) || !(name = ptsname(master))) {
+    perror("virtual beacon: could not create a pseudo-terminal");
+    exit(1);
+  }
+
+  //... hold the slave side open, and place it in raw mode, so none of the
+  //bytes we exchange are echoed or otherwise interpreted.
+  slave = open(name, O_RDWR | O_NOCTTY);
+  if(slave < 0 || tcgetattr(slave, &settings)) {
+    perror("virtual beacon: could not open a pseudo-terminal");
+    exit(1);
+  }
+  cfmakeraw(&settings);
+  tcsetattr(slave, TCSANOW, &settings);
+
+  //The firmware never waits on the master directly.
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+  //If requested, publish the terminal under a stable name.
+  if(link) {
+    unlink(link);
+    if(symlink(name, link)) {
+      perror("virtual beacon: could not create link");
+    }
+  }
+
+  printf("%s: %s\n", role, name);
+  fflush(stdout);
+
+  return master;
+}
+
+
+/**
+ * Sets up the simulated peripherals, including the pseudo-terminals
+ * which stand in for the IR transceiver and the USB connection.
+ */
+void hal_init(const struct hal_options *new_options) {
+  options = *new_options;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+  usb_fd = open_pty("usb", options.usb_link);
+  ir_fd  = open_pty("ir",  options.ir_link);
+
+  if(options.spi_capture_path && !(spi_capture = fopen(options.spi_capture_path, "wb"))) {
+    perror("virtual beacon: could not open the SPI capture file");
+    exit(1);
+  }
+}
+
+
+/**
+ * Removes any symbolic links created by hal_init.
+ */
+void hal_cleanup() {
+  if(options.usb_link) {
+    unlink(options.usb_link);
+  }
+  if(options.ir_link) {
+    unlink(options.ir_link);
+  }
+}
+
+
+/**
+ * Returns the master side of the USB pseudo-terminal.
+ */
+int hal_usb_fd() {
+  return usb_fd;
+}
+
+
+/**
+ * Returns the number of CPU cycles which have elapsed in virtual time.
+ */
+uint64_t hal_cycles() {
+  return now;
+}
+
+
+/**
+ * Calls an interrupt handler as the hardware would:
+ * with further interrupts masked until it returns.
+ */
+static void raise_interrupt(void (*vector)(void)) {
+  SREG &= ~(1 << SREG_I);
+  vector();
+  SREG |= (1 << SREG_I);
+}
+
+
+/**
+ * Returns the length of Timer 0's period, in CPU cycles,
+ * or zero if the timer is stopped. Only the normal and CTC modes are modelled.
+ */
+static uint64_t timer0_period() {
+
+  uint16_t prescaler = timer_prescalers[TCCR0B & 0x07];
+  uint32_t top = (TCCR0A & (1 << WGM01)) ? OCR0A : 0xFF;
+
+  return (uint64_t)prescaler * (top + 1);
+}
+
+
+/**
+ * Returns the length of Timer 1's period, in CPU cycles, or zero if the
+ * timer is stopped. The normal, CTC, and ICR1-topped fast PWM modes are modelled.
+ */
+static uint64_t timer1_period() {
+
+  uint16_t prescaler = timer_prescalers[TCCR1B & 0x07];
+  uint32_t top = 0xFFFF;
+
+  if((TCCR1B & (1 << WGM13)) && (TCCR1B & (1 << WGM12))) {
+    top = ICR1;
+  } else if(TCCR1B & (1 << WGM12)) {
+    top = OCR1A;
+  }
+
+  return (uint64_t)prescaler * (top + 1);
+}
+
+
+/**
+ * Returns the virtual time at which Timer 1's compare C unit next matches,
+ * or zero if its interrupt is disabled or it has already matched this period.
+ */
+static uint64_t timer1_compare_c_time() {
+
+  if(!(TIMSK1 & (1 << OCIE1C)) || timer1_compare_c_done) {
+    return 0;
+  }
+
+  return timer1_base + (uint64_t)timer_prescalers[TCCR1B & 0x07] * OCR1C;
+}
+
+
+/**
+ * Returns the number of CPU cycles required to send a single UART frame
+ * (a start bit, eight data bits, and a stop bit) at the current baud rate.
+ */
+static uint64_t uart_frame_cycles() {
+  uint64_t cycles_per_bit = (UCSR1A & (1 << U2X1)) ? 8 : 16;
+  return 10 * cycles_per_bit * ((uint64_t)UBRR1 + 1);
+}
+
+
+/**
+ * Returns true iff the IR carrier is currently being generated.
+ */
+static bool modulation_enabled() {
+  return (TCCR3B & 0x07) != 0;
+}
+
+
+/**
+ * Adds a byte to the simulated receiver's queue. If the receiver is idle,
+ * the byte finishes arriving at the given time; otherwise, it follows the
+ * bytes already queued. Returns false if the queue is full.
+ */
+static bool queue_received_byte(uint8_t value, uint64_t arrives_at) {
+
+  if(receive_count == sizeof(receive_fifo)) {
+    return false;
+  }
+
+  if(!receive_count && next_receive_at < arrives_at) {
+    next_receive_at = arrives_at;
+  }
+
+  receive_fifo[(receive_head + receive_count) % sizeof(receive_fifo)] = value;
+  ++receive_count;
+
+  return true;
+}
+
+
+/**
+ * Starts "shifting out" a single byte over the simulated IR UART.
+ * If the carrier is running, the byte is delivered to the IR terminal.
+ */
+static void start_transmission(uint8_t value) {
+
+  transmitting = true;
+  transmit_complete_at = now + uart_frame_cycles();
+  UCSR1A &= ~(1 << TXC1);
+
+  //In echo mode, the receiver hears the byte just as its transmission ends.
+  if(options.ir_echo && modulation_enabled()) {
+    queue_received_byte(value, transmit_complete_at);
+  }
+
+  if(modulation_enabled() && write(ir_fd, &value, 1) != 1) {
+    //If no one is listening, the byte is simply lost, as it would be in the air.
+  }
+}
+
+
+/**
+ * Returns the number of CPU cycles required to shift a byte out over SPI.
+ */
+static uint64_t spi_byte_cycles() {
+  uint64_t divider = spi_dividers[SPCR & ((1 << SPR1) | (1 << SPR0))];
+  return 8 * ((SPSR & (1 << SPI2X)) ? divider / 2 : divider);
+}
+
+
+/**
+ * Checks to see if the firmware has written to SPDR since we last looked,
+ * and if so, starts shifting the written byte out, capturing it.
+ */
+static void check_for_spi_transfer() {
+
+  uint8_t value;
+
+  if(SPDR >= udr_idle) {
+    return;
+  }
+
+  value = SPDR;
+  SPDR = udr_idle;
+
+  //Only a master can start a transfer; and, as on the real hardware,
+  //a write during a transfer is ignored (as a write collision).
+  if(!(SPCR & (1 << SPE)) || !(SPCR & (1 << MSTR)) || spi_transferring) {
+    return;
+  }
+
+  spi_transferring = true;
+  spi_complete_at = now + spi_byte_cycles();
+  SPSR &= ~(1 << SPIF);
+
+  if(spi_capture) {
+    fputc(value, spi_capture);
+    fflush(spi_capture);
+  }
+}
+
+
+/**
+ * Checks to see if the firmware has written to UDR1 (or SPDR) since we last
+ * looked, and if so, queues the written byte for transmission.
+ */
+static void check_for_transmit() {
+
+  uint8_t value;
+
+  check_for_spi_transfer();
+
+  //If UDR1 still holds its idle value, nothing has been written.
+  if(UDR1 >= udr_idle) {
+    return;
+  }
+
+  value = UDR1;
+  UDR1 = udr_idle | last_received;
+
+  //Writes with the transmitter disabled are ignored.
+  if(!(UCSR1B & (1 << TXEN1))) {
+    return;
+  }
+
+  //If the shift register is busy, the byte waits in the data register.
+  if(transmitting) {
+    pending_transmit = value;
+  } else {
+    start_transmission(value);
+  }
+}
+
+
+/**
+ * Handles the end of a UART frame, starting the next one if a byte is
+ * waiting, or raising the "transmit complete" interrupt otherwise.
+ */
+static void complete_transmission() {
+
+  transmitting = false;
+
+  if(pending_transmit >= 0) {
+    start_transmission(pending_transmit);
+    pending_transmit = -1;
+    return;
+  }
+
+  UCSR1A |= (1 << TXC1);
+
+  //Executing the vector clears the flag, as on the real hardware.
+  if(UCSR1B & (1 << TXCIE1)) {
+    UCSR1A &= ~(1 << TXC1);
+    raise_interrupt(USART1_TX_vect);
+    check_for_transmit();
+  }
+}
+
+
+/**
+ * Handles the end of an SPI transfer, raising the "transfer complete"
+ * interrupt if it's enabled.
+ */
+static void complete_spi_transfer() {
+
+  spi_transferring = false;
+  SPSR |= (1 << SPIF);
+
+  if(SPCR & (1 << SPIE)) {
+    SPSR &= ~(1 << SPIF);
+    raise_interrupt(SPI_STC_vect);
+    check_for_transmit();
+  }
+}
+
+
+/**
+ * Reads any bytes which have arrived on the IR terminal into the
+ * simulated receiver's queue.
+ */
+static void service_ir_input() {
+
+  uint8_t buffer[sizeof(receive_fifo)];
+  ssize_t count, i;
+
+  //Only read as much as we have room for; anything else
+  //remains buffered in the terminal.
+  count = sizeof(receive_fifo) - receive_count;
+  if(!count) {
+    return;
+  }
+
+  count = read(ir_fd, buffer, count);
+  if(count <= 0) {
+    return;
+  }
+
+  //If the receiver was idle, the first byte takes a full frame to arrive.
+  for(i = 0; i < count; ++i) {
+    queue_received_byte(buffer[i], now + uart_frame_cycles());
+  }
+}
+
+
+/**
+ * Completes receipt of a single byte, raising the receive interrupt
+ * if the receiver is enabled.
+ */
+static void deliver_received_byte() {
+
+  uint8_t value = receive_fifo[receive_head];
+
+  receive_head = (receive_head + 1) % sizeof(receive_fifo);
+  --receive_count;
+  next_receive_at = now + uart_frame_cycles();
+
+  //If the receiver is off, the byte passes by unseen.
+  if(!(UCSR1B & (1 << RXEN1))) {
+    return;
+  }
+
+  last_received = value;
+  UDR1 = udr_idle | value;
+  UCSR1A &= ~(1 << FE1);
+  UCSR1A |= (1 << RXC1);
+
+  if(UCSR1B & (1 << RXCIE1)) {
+    raise_interrupt(USART1_RX_vect);
+    check_for_transmit();
+  }
+
+  UCSR1A &= ~(1 << RXC1);
+}
+
+
+/**
+ * Runs the simulated peripherals until the given virtual time,
+ * raising each interrupt as it becomes due.
+ */
+static void run_until(uint64_t target) {
+
+  while(now < target) {
+
+    uint64_t next = target;
+    uint64_t period0 = timer0_period();
+    uint64_t period1 = timer1_period();
+    uint64_t compare_c;
+
+    //Track the timers' starting and stopping.
+    if(period0 && !timer0_running) {
+      timer0_base = now;
+    }
+    timer0_running = (period0 != 0);
+
+    if(period1 && !timer1_running) {
+      timer1_base = now;
+    }
+    timer1_running = (period1 != 0);
+
+    compare_c = timer1_running ? timer1_compare_c_time() : 0;
+
+    //Find the next event that's due...
+    if(timer0_running && timer0_base + period0 < next) {
+      next = timer0_base + period0;
+    }
+    if(timer1_running && timer1_base + period1 < next) {
+      next = timer1_base + period1;
+    }
+    if(compare_c && compare_c < now) {
+      //A compare value moved below the count doesn't match until the next period.
+      timer1_compare_c_done = true;
+      compare_c = 0;
+    }
+    if(compare_c && compare_c < next) {
+      next = compare_c;
+    }
+    if(next_start_of_frame < next) {
+      next = next_start_of_frame;
+    }
+    if(transmitting && transmit_complete_at < next) {
+      next = transmit_complete_at;
+    }
+    if(receive_count && next_receive_at < next) {
+      next = next_receive_at;
+    }
+    if(spi_transferring && spi_complete_at < next) {
+      next = spi_complete_at;
+    }
+
+    //... advance to it...
+    now = next;
+
+    //... and handle each of the events that have come due.
+    if(timer0_running && now >= timer0_base + period0) {
+      timer0_base += period0;
+
+      if(TIMSK0 & (1 << OCIE0A)) {
+        raise_interrupt(TIMER0_COMPA_vect);
+        check_for_transmit();
+      }
+
+      //The firmware keeps OCR0B at zero, so the compare B flag is set at the
+      //start of every period; it's serviced as soon as it's enabled.
+      if(TIMSK0 & (1 << OCIE0B)) {
+        raise_interrupt(TIMER0_COMPB_vect);
+        check_for_transmit();
+      }
+    }
+
+    if(compare_c && now >= compare_c) {
+      timer1_compare_c_done = true;
+      TCNT1 = OCR1C;
+      raise_interrupt(TIMER1_COMPC_vect);
+    }
+
+    if(timer1_running && now >= timer1_base + period1) {
+      timer1_base += period1;
+      timer1_compare_c_done = false;
+      TCNT1 = 0;
+
+      if(TIMSK1 & (1 << TOIE1)) {
+        raise_interrupt(TIMER1_OVF_vect);
+      }
+    }
+
+    if(now >= next_start_of_frame) {
+      next_start_of_frame += F_CPU / 1000UL;
+      raise_interrupt(usb_pty_start_of_frame);
+      raise_interrupt(usb_pty_receive_out);
+      check_for_transmit();
+    }
+
+    if(transmitting && now >= transmit_complete_at) {
+      complete_transmission();
+    }
+
+    if(receive_count && now >= next_receive_at) {
+      deliver_received_byte();
+    }
+
+    if(spi_transferring && now >= spi_complete_at) {
+      complete_spi_transfer();
+    }
+  }
+}
+
+
+/**
+ * Returns the virtual time that the board should have reached,
+ * according to the wall clock and the configured time scale.
+ */
+static uint64_t target_cycles() {
+
+  struct timespec current_time;
+  double elapsed;
+
+  //When free-running, simply advance by a fixed quantum.
+  if(options.time_scale <= 0) {
+    return now + free_run_quantum;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &current_time);
+  elapsed = (current_time.tv_sec - start_time.tv_sec) +
+            (current_time.tv_nsec - start_time.tv_nsec) / 1e9;
+
+  return (uint64_t)(elapsed * options.time_scale * F_CPU);
+}
+
+
+/**
+ * Waits (briefly) for activity on any of the simulated board's terminals.
+ */
+static void wait_for_activity() {
+
+  struct pollfd descriptors[2] = {
+    { .fd = usb_fd, .events = POLLIN },
+    { .fd = ir_fd,  .events = POLLIN },
+  };
+
+  //Free-running boards never wait on the wall clock.
+  if(options.time_scale <= 0) {
+    return;
+  }
+
+  poll(descriptors, 2, 1);
+}
+
+
+/**
+ * Advances virtual time, raising any interrupts which have become due.
+ */
+void hal_pump(bool idle) {
+
+  uint64_t target;
+
+  //Interrupts can't be delivered while they're masked, so leave
+  //virtual time where it is until the firmware unmasks them.
+  if(!(SREG & (1 << SREG_I))) {
+    return;
+  }
+
+  //Interrupts are raised as soon as they're due, so no flag is ever left
+  //pending; and on the real part, writing a flag clears it.
+  TIFR0 = 0;
+  TIFR1 = 0;
+
+  //Pick up any work the firmware has created in the meantime.
+  check_for_transmit();
+  service_ir_input();
+
+  //Advance to the current virtual time, a slice at a time.
+  target = target_cycles();
+  if(target > now + maximum_pump_quantum) {
+    target = now + maximum_pump_quantum;
+  }
+  run_until(target);
+
+  //Keep the timers' count registers roughly current,
+  //as the firmware uses them as a source of jitter.
+  if(timer0_running) {
+    TCNT0 = (now - timer0_base) / timer_prescalers[TCCR0B & 0x07];
+  }
+  if(timer1_running) {
+    TCNT1 = (now - timer1_base) / timer_prescalers[TCCR1B & 0x07];
+  }
+
+  if(idle) {
+    wait_for_activity();
+  }
+}
@@ -0,0 +1,109 @@
+/**
+ * hal.h
+ * Simulated peripherals for the host-native ("virtual beacon") build.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __HOST_HAL_H__
+#define __HOST_HAL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Options which control the simulated board.
+ */
+struct hal_options {
+
+  // The rate at which virtual time passes, relative to wall-clock time.
+  // A value of 1 runs the board in real time; larger values run it faster.
+  // A value of zero "free-runs" the board, advancing virtual time by a
+  // fixed quantum on every pump, regardless of the wall clock.
+  double time_scale;
+
+  // If non-null, a symbolic link to the pseudo-terminal which carries the
+  // board's USB (CDC) serial connection will be created at this path.
+  const char *usb_link;
+
+  // If non-null, a symbolic link to the pseudo-terminal which carries the
+  // board's IR channel will be created at this path.
+  const char *ir_link;
+
+  // If non-null, every byte the board sends over its SPI port (e.g. its
+  // debug trace) is written to the file at this path.
+  const char *spi_capture_path;
+
+  // If true, the board hears its own IR transmissions, as a real board
+  // does when its signal is reflected back to its receiver.
+  bool ir_echo;
+
+};
+
+/**
+ * Sets up the simulated peripherals, including the pseudo-terminal
+ * which stands in for the IR transceiver.
+ */
+void hal_init(const struct hal_options *options);
+
+/**
+ * Advances virtual time, raising any interrupts which have become due.
+ * Interrupts are only delivered while the simulated I flag is set.
+ *
+ * idle: True iff the firmware has nothing else to do; in real-time mode,
+ *    the simulator may then sleep until the next event is due.
+ */
+void hal_pump(bool idle);
+
+/**
+ * Returns the number of CPU cycles which have elapsed in virtual time.
+ */
+uint64_t hal_cycles();
+
+/**
+ * Returns the (non-blocking) master side of the pseudo-terminal which
+ * carries the simulated USB serial connection.
+ */
+int hal_usb_fd();
+
+/**
+ * Removes any symbolic links created by hal_init. Safe to call from
+ * a signal handler.
+ */
+void hal_cleanup();
+
+/**
+ * Called by the simulator once per (virtual) millisecond, emulating the
+ * USB start-of-frame interrupt. Implemented by the simulated USB serial port.
+ */
+void usb_pty_start_of_frame();
+
+/**
+ * Called by the simulator once per (virtual) millisecond, emulating the
+ * receipt of data by the USB endpoint interrupt. Implemented by the
+ * simulated USB serial port.
+ */
+void usb_pty_receive_out();
+
+#endif
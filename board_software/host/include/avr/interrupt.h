@@ -0,0 +1,62 @@
+/**
+ * avr/interrupt.h (host build)
+ * Interrupt declarations for the host-native beacon build. Interrupt
+ * service routines become ordinary functions, which the simulated
+ * peripherals call whenever the global interrupt flag allows it.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __HOST_AVR_INTERRUPT_H__
+#define __HOST_AVR_INTERRUPT_H__
+
+#include <avr/io.h>
+
+/**
+ * Enables and disables interrupts by toggling the simulated I flag.
+ */
+#define sei() (SREG |= (1 << SREG_I))
+#define cli() (SREG &= ~(1 << SREG_I))
+
+/**
+ * Defines an interrupt service routine. On the host, this is simply a
+ * function with the vector's name; the simulator provides weak, empty
+ * definitions for any vector the firmware doesn't implement.
+ */
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+/**
+ * The interrupt vectors which the simulated peripherals can raise.
+ */
+void TIMER0_COMPA_vect(void);
+void TIMER0_COMPB_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER1_COMPB_vect(void);
+void TIMER1_COMPC_vect(void);
+void TIMER1_OVF_vect(void);
+void USART1_RX_vect(void);
+void USART1_TX_vect(void);
+void SPI_STC_vect(void);
+
+#endif
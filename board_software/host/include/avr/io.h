@@ -0,0 +1,188 @@
+/**
+ * avr/io.h (host build)
+ * Simulated ATmega32u4 register file, used when the beacon firmware is
+ * compiled as a native Linux process. Each register is an ordinary global,
+ * which the simulated peripherals in host/hal.c read and update.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __HOST_AVR_IO_H__
+#define __HOST_AVR_IO_H__
+
+#include <stdint.h>
+
+//
+// Status register. Only the global interrupt flag (bit 7) is modelled.
+//
+extern volatile uint8_t SREG;
+#define SREG_I 7
+
+//
+// System clock prescaler.
+//
+extern volatile uint8_t CLKPR;
+
+//
+// General purpose I/O ports.
+//
+extern volatile uint8_t DDRB, PORTB, PINB;
+extern volatile uint8_t DDRC, PORTC, PINC;
+extern volatile uint8_t DDRD, PORTD, PIND;
+extern volatile uint8_t DDRE, PORTE, PINE;
+extern volatile uint8_t DDRF, PORTF, PINF;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC6 6
+#define PC7 7
+#define PD7 7
+
+//
+// Timer/Counter 0 (8-bit), used to generate the system tick.
+//
+extern volatile uint8_t TCCR0A, TCCR0B, TIMSK0, TIFR0;
+extern volatile uint8_t TCNT0, OCR0A, OCR0B;
+
+#define WGM00  0
+#define WGM01  1
+#define CS00   0
+#define CS01   1
+#define CS02   2
+#define WGM02  3
+#define TOIE0  0
+#define OCIE0A 1
+#define OCIE0B 2
+
+//
+// Timer/Counter 1 (16-bit), used to dim the lights.
+//
+extern volatile uint8_t  TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, OCR1C, ICR1;
+
+#define WGM10  0
+#define WGM11  1
+#define COM1C0 2
+#define COM1C1 3
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define WGM13  4
+#define TOIE1  0
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCIE1C 3
+#define TOV1   0
+#define OCF1A  1
+#define OCF1B  2
+#define OCF1C  3
+
+//
+// Timer/Counter 3 (16-bit), used to generate the IR carrier.
+//
+extern volatile uint8_t  TCCR3A, TCCR3B, TCCR3C, TIMSK3, TIFR3;
+extern volatile uint16_t TCNT3, OCR3A, OCR3B, OCR3C, ICR3;
+
+#define CS30   0
+#define CS31   1
+#define CS32   2
+#define WGM32  3
+#define COM3A0 6
+#define COM3A1 7
+
+//
+// Timer/Counter 4 (10-bit), used only by the optional interrupt profiler.
+// The simulator doesn't advance it, so profiled durations read as zero;
+// and its overflow flag always reads as clear.
+//
+extern volatile uint8_t TCCR4A, TCCR4B, TCCR4C, TCCR4D;
+extern volatile uint8_t TCNT4, TC4H, OCR4C;
+volatile uint8_t *hal_timer4_interrupt_flags(void);
+#define TIFR4 (*hal_timer4_interrupt_flags())
+
+#define CS40   0
+#define CS41   1
+#define TOV4   2
+
+//
+// USART 1, used for IR communications.
+//
+// Note that UDR1 is deliberately wider than the real eight-bit register:
+// the simulator keeps the "idle" value above 0xFF, so any write performed
+// by the firmware (which is always a byte) can be detected unambiguously.
+//
+extern volatile uint8_t  UCSR1A, UCSR1B, UCSR1C;
+extern volatile uint16_t UBRR1;
+extern volatile uint16_t UDR1;
+
+#define MPCM1  0
+#define U2X1   1
+#define UPE1   2
+#define DOR1   3
+#define FE1    4
+#define UDRE1  5
+#define TXC1   6
+#define RXC1   7
+
+#define TXB81  0
+#define RXB81  1
+#define UCSZ12 2
+#define TXEN1  3
+#define RXEN1  4
+#define UDRIE1 5
+#define TXCIE1 6
+#define RXCIE1 7
+
+#define UCPOL1 0
+#define UCSZ10 1
+#define UCSZ11 2
+#define USBS1  3
+
+//
+// Serial Peripheral Interface, used for the debug trace. As with UDR1,
+// SPDR is wider than the real register, so writes can be detected.
+//
+extern volatile uint8_t  SPCR, SPSR;
+extern volatile uint16_t SPDR;
+
+#define SPR0  0
+#define SPR1  1
+#define MSTR  4
+#define SPE   6
+#define SPIE  7
+#define SPI2X 0
+#define SPIF  7
+
+#endif
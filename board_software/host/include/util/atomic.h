@@ -0,0 +1,51 @@
+/**
+ * util/atomic.h (host build)
+ * A host-side equivalent of avr-libc's ATOMIC_BLOCK, built on the
+ * simulated interrupt flag.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __HOST_UTIL_ATOMIC_H__
+#define __HOST_UTIL_ATOMIC_H__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+static inline uint8_t __iCliRetVal(void) {
+  cli();
+  return 1;
+}
+
+static inline void __iRestore(const uint8_t *saved_sreg) {
+  SREG = *saved_sreg;
+}
+
+#define ATOMIC_RESTORESTATE \
+  uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+
+#define ATOMIC_BLOCK(type) \
+  for(type, __ToDo = __iCliRetVal(); __ToDo; __ToDo = 0)
+
+#endif
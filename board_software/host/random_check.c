@@ -0,0 +1,172 @@
+/**
+ * random_check.c
+ * Host-side statistical check of the beacon's random number generator
+ * (see random.c), which checks that its bytes, and pairs of consecutive
+ * bytes, are evenly distributed, both with and without entropy being stirred
+ * in. The board only ever uses a few bytes at a time, so this looks at many
+ * short windows of the sequence, each much shorter than the generator's
+ * period; over whole periods, any full-period generator looks perfect.
+ *
+ * usage: make random_check (which make host also runs)
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "random.h"
+
+/**
+ * The generator masks interrupts while it runs; this check doesn't use the
+ * simulator, so it provides the (simulated) status register itself.
+ */
+volatile uint8_t SREG;
+
+/**
+ * The period of the underlying generator, when no entropy is stirred in.
+ */
+#define GENERATOR_PERIOD 65535UL
+
+/**
+ * The number of bytes in each window, and the number of windows checked.
+ */
+#define WINDOW_SIZE  4096
+#define WINDOW_COUNT 256
+
+/**
+ * The range of acceptable chi-squared statistics for a window; with 255
+ * degrees of freedom, a uniform source falls outside this range only 0.2%
+ * of the time. Too small a statistic is as suspect as too large a one:
+ * it means the bytes are more even than chance would make them.
+ */
+#define MINIMUM_CHI_SQUARED 190.8
+#define MAXIMUM_CHI_SQUARED 330.5
+
+/**
+ * The number of the WINDOW_COUNT * 2 statistics which may fall outside
+ * the range above; a uniform source has about one, and more than this
+ * fewer than once in a thousand runs.
+ */
+#define MAXIMUM_FAILED_STATISTICS 5
+
+
+/**
+ * Returns the chi-squared statistic for the given 256 counts, which
+ * should each be close to the given expected count.
+ */
+static double chi_squared(const unsigned long *counts, double expected) {
+
+  double statistic = 0;
+  int i;
+
+  for(i = 0; i < 256; ++i) {
+    statistic += (counts[i] - expected) * (counts[i] - expected) / expected;
+  }
+
+  return statistic;
+}
+
+/**
+ * Returns true iff the given chi-squared statistic is in the acceptable range.
+ */
+static bool plausible(double statistic) {
+  return statistic > MINIMUM_CHI_SQUARED && statistic < MAXIMUM_CHI_SQUARED;
+}
+
+
+/**
+ * Draws WINDOW_COUNT windows of bytes from the generator, each starting at
+ * a random point in its period (so no part of the sequence is counted more
+ * than chance would have it), and checks the distribution of the bytes in each, and of the non-overlapping
+ * pairs of bytes in each (by their high nibbles, so each pair falls in one
+ * of 256 cells). If jitter is true, a simulated jitter sample is stirred
+ * into the entropy pool before every few bytes, as IR and USB events
+ * would on the board. Returns true iff the windows pass.
+ */
+static bool check_generator(const char *description, bool jitter) {
+
+  unsigned long byte_counts[256], pair_counts[256];
+  unsigned long window, i, skip;
+  unsigned int failures = 0;
+  double statistic, smallest = 1e9, largest = 0;
+  uint8_t value, previous = 0;
+  bool passed;
+
+  for(window = 0; window < WINDOW_COUNT; ++window) {
+
+    for(i = 0; i < 256; ++i) {
+      byte_counts[i] = pair_counts[i] = 0;
+    }
+
+    for(skip = rand() % GENERATOR_PERIOD; skip; --skip) {
+      random_byte();
+    }
+
+    for(i = 0; i < WINDOW_SIZE; ++i) {
+
+      if(jitter && !(i % 4)) {
+        add_entropy(rand());
+      }
+
+      value = random_byte();
+      ++byte_counts[value];
+
+      if(i % 2) {
+        ++pair_counts[(previous & 0xF0) | (value >> 4)];
+      }
+      previous = value;
+    }
+
+    statistic = chi_squared(byte_counts, WINDOW_SIZE / 256.0);
+    failures += !plausible(statistic);
+    smallest = (statistic < smallest) ? statistic : smallest;
+    largest = (statistic > largest) ? statistic : largest;
+
+    statistic = chi_squared(pair_counts, WINDOW_SIZE / 2 / 256.0);
+    failures += !plausible(statistic);
+    smallest = (statistic < smallest) ? statistic : smallest;
+    largest = (statistic > largest) ? statistic : largest;
+  }
+
+  passed = (failures <= MAXIMUM_FAILED_STATISTICS);
+
+  printf("%-18s chi-squared %.1f to %.1f (range %.1f to %.1f), %u of %u outside (limit %u): %s\n",
+      description, smallest, largest, MINIMUM_CHI_SQUARED, MAXIMUM_CHI_SQUARED,
+      failures, WINDOW_COUNT * 2, MAXIMUM_FAILED_STATISTICS, passed ? "pass" : "FAIL");
+
+  return passed;
+}
+
+
+int main() {
+
+  bool passed = true;
+
+  passed &= check_generator("generator alone:", false);
+  passed &= check_generator("with jitter:", true);
+
+  return passed ? 0 : 1;
+}
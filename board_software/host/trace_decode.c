@@ -0,0 +1,194 @@
+/**
+ * trace_decode.c
+ * Decodes a debug trace captured from a beacon board's SPI port (or from
+ * the virtual beacon's -t option) into a readable timeline. See debug.h
+ * for the trace format.
+ *
+ * usage: trace_decode [capture_file]; reads standard input by default.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "debug.h"
+#include "timers.h"
+#include "state.h"
+
+/**
+ * The names of each of the traced events, indexed by event ID.
+ */
+static const char *event_names[TRACE_EVENT_COUNT] = {
+  [TRACE_EPOCH]            = "epoch",
+  [TRACE_DROPPED]          = "dropped",
+  [TRACE_TEXT]             = "text",
+  [TRACE_PC_REQUEST]       = "pc_request",
+  [TRACE_STATE_CHANGE]     = "state_change",
+  [TRACE_IR_TRANSMIT]      = "ir_transmit",
+  [TRACE_IR_RECEIVE]       = "ir_receive",
+  [TRACE_IR_FRAMING_ERROR] = "ir_framing_error",
+  [TRACE_CLAIM_ACCEPTED]   = "claim_accepted",
+  [TRACE_CLAIM_REJECTED]   = "claim_rejected",
+  [TRACE_CLAIM_THROTTLED]  = "claim_throttled",
+};
+
+/**
+ * Text written to stdout by the firmware, which is printed a line at a time.
+ */
+static char text[256];
+static unsigned text_length = 0;
+static double text_started_at = 0;
+
+
+/**
+ * Prints any text we've accumulated as a single timeline entry.
+ */
+static void flush_text() {
+  if(text_length) {
+    printf("%12.6f  %-16s \"%.*s\"\n", text_started_at, "text", text_length, text);
+    text_length = 0;
+  }
+}
+
+/**
+ * Adds a single character of text to the timeline.
+ */
+static void add_text(double time, char character) {
+
+  if(!text_length) {
+    text_started_at = time;
+  }
+
+  if(character != '\n') {
+    text[text_length++] = character;
+  }
+
+  if(character == '\n' || text_length == sizeof(text)) {
+    flush_text();
+  }
+}
+
+/**
+ * Prints a raw board state, in the same form as the PC software.
+ */
+static void print_state(uint8_t raw) {
+  BoardState state = { .raw_data = raw };
+  printf("mode=%u affiliation=%u owner=%u", state.mode, state.affiliation, state.owner);
+}
+
+/**
+ * Prints a single (non-text) record as a timeline entry.
+ */
+static void print_record(double time, uint8_t event, uint8_t count, const uint8_t *arguments) {
+
+  flush_text();
+
+  if(event < TRACE_EVENT_COUNT && event_names[event]) {
+    printf("%12.6f  %-16s ", time, event_names[event]);
+  } else {
+    printf("%12.6f  event %-10u ", time, event);
+  }
+
+  switch(event) {
+
+    case TRACE_DROPPED:
+      printf("%u record(s) lost", arguments[0]);
+      break;
+
+    case TRACE_PC_REQUEST:
+    case TRACE_STATE_CHANGE:
+      print_state(arguments[0]);
+      break;
+
+    case TRACE_IR_RECEIVE:
+      printf("value=0x%02x distance=%u", arguments[0], arguments[1]);
+      break;
+
+    case TRACE_CLAIM_ACCEPTED:
+      printf("value=0x%02x owner=%u", arguments[0], arguments[1]);
+      break;
+
+    default:
+      printf("0x%02x", arguments[0]);
+      if(count > 1) {
+        printf(" 0x%02x", arguments[1]);
+      }
+      break;
+  }
+
+  printf("\n");
+}
+
+
+int main(int argc, char *argv[]) {
+
+  FILE *input = stdin;
+  uint8_t record[5];
+  uint8_t count;
+  uint32_t epoch = 0, ticks;
+  double time;
+
+  if(argc > 2) {
+    fprintf(stderr, "usage: %s [capture_file]\n", argv[0]);
+    return 1;
+  }
+
+  if(argc == 2 && !(input = fopen(argv[1], "rb"))) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  //Read each record's fixed-size part: its header, timestamp, and first argument...
+  while(fread(record, 1, 4, input) == 4) {
+
+    //... and its second argument, if it has one.
+    count = (record[0] & TRACE_TWO_ARGUMENTS) ? 2 : 1;
+    if(count == 2 && fread(&record[4], 1, 1, input) != 1) {
+      break;
+    }
+
+    ticks = (epoch << 16) | ((uint32_t)record[1] << 8) | record[2];
+    time  = ticks / (double)TIMER_TICKS_PER_SECOND;
+
+    switch(record[0] & ~TRACE_TWO_ARGUMENTS) {
+
+      //Epoch records only update our notion of the time.
+      case TRACE_EPOCH:
+        epoch = ((uint32_t)record[3] << 8) | record[4];
+        break;
+
+      case TRACE_TEXT:
+        add_text(time, record[3]);
+        break;
+
+      default:
+        print_record(time, record[0] & ~TRACE_TWO_ARGUMENTS, count, &record[3]);
+        break;
+    }
+  }
+
+  flush_text();
+  return 0;
+}
@@ -0,0 +1,258 @@
+/**
+ * usb_serial_pty.c
+ * Host-native implementation of the usb_serial API, which presents the
+ * beacon's CDC serial port as a pseudo-terminal. The buffering of the
+ * real implementation is preserved: outgoing data is held in a
+ * packet-sized buffer until the packet fills, it's explicitly flushed,
+ * or TRANSMIT_FLUSH_TIMEOUT start-of-frames pass; incoming data is
+ * queued in a RAM buffer by the (simulated) endpoint interrupt; and data
+ * queued by usb_serial_queue is moved into the endpoint at each
+ * (simulated) start-of-frame.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "usb_serial/usb_serial.h"
+#include "hal.h"
+
+// Mirror the endpoint configuration of the real implementation.
+#define CDC_RX_SIZE             64
+#define CDC_TX_SIZE             64
+#define RECEIVE_BUFFER_SIZE     64
+#define TRANSMIT_BUFFER_SIZE    256
+#define TRANSMIT_FLUSH_TIMEOUT  5   /* in milliseconds */
+
+static int usb_fd = -1;
+
+// Data received from the PC, waiting to be read by the firmware.
+static volatile uint8_t receive_buffer[RECEIVE_BUFFER_SIZE];
+static volatile uint8_t receive_head = 0, receive_tail = 0;
+
+// The contents of the (simulated) IN endpoint.
+static uint8_t transmit_buffer[CDC_TX_SIZE];
+static uint8_t transmit_length = 0;
+static volatile uint8_t transmit_flush_timer = 0;
+
+// Data queued to be moved into the IN endpoint at the next start-of-frame,
+// and whether the firmware has asked for it to be released promptly.
+static volatile uint8_t transmit_queue[TRANSMIT_BUFFER_SIZE];
+static volatile uint8_t transmit_queue_head = 0, transmit_queue_tail = 0;
+static volatile uint8_t transmit_release = 0;
+
+/**
+ * Releases the IN endpoint's contents to the host.
+ */
+static void send_in_packet() {
+
+  //If the host isn't reading, the data is lost, much as it would be
+  //after TRANSMIT_TIMEOUT on the real board.
+  if(transmit_length && write(usb_fd, transmit_buffer, transmit_length) < 0) {
+  }
+
+  transmit_length = 0;
+  transmit_flush_timer = 0;
+}
+
+/**
+ * Emulates the endpoint interrupt's handling of the CDC OUT endpoint,
+ * which copies as much received data as will fit into the receive buffer.
+ * Anything else stays in the terminal, as it would stay (NAKed) on the PC.
+ */
+void usb_pty_receive_out() {
+
+  uint8_t packet[CDC_RX_SIZE];
+  uint8_t space = (receive_tail - receive_head - 1) & (RECEIVE_BUFFER_SIZE - 1);
+  ssize_t count, i;
+
+  if(!space) {
+    return;
+  }
+
+  count = read(usb_fd, packet, space < CDC_RX_SIZE ? space : CDC_RX_SIZE);
+
+  for(i = 0; i < count; ++i) {
+    receive_buffer[receive_head] = packet[i];
+    receive_head = (receive_head + 1) & (RECEIVE_BUFFER_SIZE - 1);
+  }
+}
+
+// initialize USB serial
+void usb_init(void) {
+  usb_fd = hal_usb_fd();
+  sei();
+}
+
+// the virtual port is always configured
+uint8_t usb_configured(void) {
+  hal_pump(false);
+  return 1;
+}
+
+// get the next character, or -1 if nothing received
+int16_t usb_serial_getchar(void) {
+
+  uint8_t c;
+
+  if(receive_tail == receive_head) {
+    return -1;
+  }
+
+  c = receive_buffer[receive_tail];
+  receive_tail = (receive_tail + 1) & (RECEIVE_BUFFER_SIZE - 1);
+
+  return c;
+}
+
+// number of bytes available in the receive buffer
+uint8_t usb_serial_available(void) {
+  return (receive_head - receive_tail) & (RECEIVE_BUFFER_SIZE - 1);
+}
+
+// discard any buffered input
+void usb_serial_flush_input(void) {
+  uint8_t packet[CDC_RX_SIZE];
+
+  while(read(usb_fd, packet, sizeof(packet)) > 0);
+  receive_tail = receive_head;
+}
+
+// transmit a character.  0 returned on success, -1 on error
+int8_t usb_serial_putchar(uint8_t c) {
+
+  transmit_buffer[transmit_length++] = c;
+
+  // if this completed a packet, transmit it now!
+  if(transmit_length == CDC_TX_SIZE) {
+    send_in_packet();
+  } else {
+    transmit_flush_timer = TRANSMIT_FLUSH_TIMEOUT;
+  }
+
+  return 0;
+}
+
+// transmit a character, but do not wait if the buffer is full
+int8_t usb_serial_putchar_nowait(uint8_t c) {
+  return usb_serial_putchar(c);
+}
+
+// transmit a buffer.
+int8_t usb_serial_write(const uint8_t *buffer, uint16_t size) {
+
+  while(size--) {
+    usb_serial_putchar(*buffer++);
+  }
+
+  return 0;
+}
+
+// immediately transmit any buffered output.
+void usb_serial_flush_output(void) {
+  if(transmit_flush_timer) {
+    send_in_packet();
+  }
+}
+
+// the host-side line settings are meaningless here
+uint32_t usb_serial_get_baud(void)       { return 9600; }
+uint8_t usb_serial_get_stopbits(void)    { return USB_SERIAL_1_STOP; }
+uint8_t usb_serial_get_paritytype(void)  { return USB_SERIAL_PARITY_NONE; }
+uint8_t usb_serial_get_numbits(void)     { return 8; }
+uint8_t usb_serial_get_control(void)     { return USB_SERIAL_DTR | USB_SERIAL_RTS; }
+int8_t usb_serial_set_control(uint8_t s) { return 0; }
+
+/**
+ * Moves the queued data into the IN endpoint, as the real implementation's
+ * usb_transmit_queued does. If the PC has stopped reading, and the terminal
+ * is full, the data stays queued, as it would while the real endpoint's
+ * banks are full.
+ */
+static void transmit_queued() {
+
+  struct pollfd terminal = { .fd = usb_fd, .events = POLLOUT };
+
+  if(poll(&terminal, 1, 0) <= 0 || !(terminal.revents & POLLOUT)) {
+    return;
+  }
+
+  while(transmit_queue_tail != transmit_queue_head) {
+    usb_serial_putchar(transmit_queue[transmit_queue_tail]);
+    transmit_queue_tail = (transmit_queue_tail + 1) & (TRANSMIT_BUFFER_SIZE - 1);
+  }
+
+  if(transmit_release) {
+    transmit_release = 0;
+    usb_serial_flush_output();
+  }
+}
+
+// queue a buffer for transmission, without waiting
+int8_t usb_serial_queue(const uint8_t *buffer, uint8_t size) {
+
+  uint8_t head = transmit_queue_head;
+
+  if(size > ((transmit_queue_tail - head - 1) & (TRANSMIT_BUFFER_SIZE - 1))) {
+    return -1;
+  }
+
+  while(size--) {
+    transmit_queue[head] = *buffer++;
+    head = (head + 1) & (TRANSMIT_BUFFER_SIZE - 1);
+  }
+
+  transmit_queue_head = head;
+  return 0;
+}
+
+// release the queued data as soon as possible
+void usb_serial_release(void) {
+  transmit_release = 1;
+  transmit_queued();
+}
+
+/**
+ * Emulates the start-of-frame portion of USB_GEN_vect, which moves any
+ * queued data into the endpoint, and sends any partially-filled packet
+ * once the flush timer expires.
+ */
+void usb_pty_start_of_frame() {
+
+  uint8_t t;
+
+  transmit_queued();
+  t = transmit_flush_timer;
+
+  if(t) {
+    transmit_flush_timer = --t;
+    if(!t) {
+      send_in_packet();
+    }
+  }
+}
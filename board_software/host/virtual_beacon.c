@@ -0,0 +1,117 @@
+/**
+ * virtual_beacon.c
+ * Runs the beacon board firmware as a native Linux process.
+ *
+ * The board's USB serial port appears as a pseudo-terminal, which can be
+ * opened like a real board (e.g. JDBeacon::Board.new("/dev/pts/N")); its
+ * IR channel appears as a second pseudo-terminal, on which bytes "sent"
+ * by the beacon can be read, and to which robot responses can be written.
+ *
+ * Usage: virtual_beacon [-s scale] [-u usb_link] [-i ir_link] [-t trace_file] [-e]
+ *
+ *   -s scale     Runs virtual time at the given multiple of real time.
+ *                A scale of zero free-runs the board as fast as possible.
+ *   -u usb_link  Creates a symbolic link to the USB terminal at usb_link.
+ *   -i ir_link   Creates a symbolic link to the IR terminal at ir_link.
+ *   -t trace_file
+ *                Writes every byte the board sends over its SPI port (its
+ *                binary debug trace) to trace_file; see host/trace_decode.
+ *   -e           Echoes the board's IR transmissions back to its own receiver,
+ *                as a real board hears its signal reflected off nearby objects.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hal.h"
+
+/**
+ * The firmware's own main function, renamed at compile time.
+ */
+int firmware_main();
+
+/**
+ * Cleans up after the simulated board when we're asked to stop.
+ */
+static void handle_termination(int signal_number) {
+  hal_cleanup();
+  _exit(0);
+}
+
+/**
+ * Prints a brief usage summary.
+ */
+static void print_usage(const char *name) {
+  fprintf(stderr, "usage: %s [-s scale] [-u usb_link] [-i ir_link] [-t trace_file] [-e]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+
+  struct hal_options options = { .time_scale = 1.0 };
+  int option;
+
+  //Parse the command-line options...
+  while((option = getopt(argc, argv, "s:u:i:t:eh")) != -1) {
+    switch(option) {
+
+      case 's':
+        options.time_scale = atof(optarg);
+        break;
+
+      case 'u':
+        options.usb_link = optarg;
+        break;
+
+      case 'i':
+        options.ir_link = optarg;
+        break;
+
+      case 't':
+        options.spi_capture_path = optarg;
+        break;
+
+      case 'e':
+        options.ir_echo = true;
+        break;
+
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+
+  //... bring up the simulated peripherals...
+  hal_init(&options);
+  signal(SIGINT, handle_termination);
+  signal(SIGTERM, handle_termination);
+
+  //... and run the firmware as though it were on a real board.
+  return firmware_main();
+}
@@ -29,7 +29,11 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include "ir_comm.h"
+#include "counters.h"
+#include "profiler.h"
+#include "random.h"
 
 /**
  * Specifies the carrier frequency which should be used for IR communications.
@@ -39,11 +43,27 @@ static const unsigned long carrier_frequency = 38000UL;
 
 
 /**
- * Specifies the signaling rate ("symbol" or "baud" rate) for the UART.
- * In this case, this is roughly equal to the number of bits transmitted
- * per second, including the protocol overhead ("start" and "stop bits").
+ * Specifies the signaling rates ("symbol" or "baud" rates) the UART can use.
+ * Each is roughly equal to the number of bits transmitted per second,
+ * including the protocol overhead ("start" and "stop bits"). Faster rates are
+ * limited by the IR receivers, whose demodulators need several carrier cycles
+ * to register each bit; the first rate is the one used at startup.
  */
-static const unsigned long uart_baud_rate = 300;
+static const uint16_t supported_baud_rates[] = { 300, 600, 1200, 2400, 4800 };
+#define SUPPORTED_BAUD_RATE_COUNT (sizeof(supported_baud_rates) / sizeof(supported_baud_rates[0]))
+
+/**
+ * The index of the current signaling rate in supported_baud_rates.
+ */
+static volatile uint8_t baud_rate_index = 0;
+
+
+/**
+ * Specifies how long after a transmission completes we should still expect
+ * to receive its echo, in timer ticks. This allows for the latency of the
+ * IR receiver, which demodulates the signal before the UART sees it.
+ */
+static const uint16_t echo_guard_ticks = TIMER_TICKS_PER_SECOND / 200;
 
 
 /**
@@ -51,6 +71,53 @@ static const unsigned long uart_baud_rate = 300;
  */
 static volatile uint8_t value_to_continuously_transmit;
 
+/**
+ * Flag which indicates whether we're currently in continuous transmission mode.
+ */
+static volatile uint8_t continuously_transmitting = 0;
+
+/**
+ * The continuous transmission schedule: the interval between the starts of
+ * successive bursts, in timer ticks; the number of times each value is sent,
+ * back to back, in a single burst; and the largest amount by which each
+ * interval is randomly lengthened or shortened, in timer ticks. Jitter keeps
+ * neighbouring beacons from transmitting in lockstep.
+ */
+static volatile uint16_t transmit_interval = TIMER_TICKS_PER_SECOND;
+static volatile uint8_t transmit_burst_length = 1;
+static volatile uint16_t transmit_jitter = 0;
+
+/**
+ * The slotted (time-division) schedule, which gives each beacon on a field
+ * its own slot in a shared, repeating frame, so their transmissions never
+ * overlap: the length of the frame, and the start of our slot within it, in
+ * timer ticks; and a time at which a frame began, by our own clock. A frame
+ * length of zero disables slotting, leaving the interval and jitter in charge.
+ */
+static volatile uint16_t transmit_frame_length = 0;
+static volatile uint16_t transmit_slot = 0;
+static volatile uint32_t transmit_frame_started_at = 0;
+
+/**
+ * The timer event which starts the next burst, or NO_TIMER_EVENT;
+ * and the number of transmissions left in the current burst.
+ */
+static volatile TimerEvent next_burst = NO_TIMER_EVENT;
+static volatile uint8_t burst_transmissions_remaining = 0;
+
+/**
+ * Flag which indicates whether a byte is currently being transmitted.
+ */
+static volatile uint8_t transmitting = 0;
+
+/**
+ * The time at which continuous transmission was last started, and the delay
+ * between that and the start of its first transmission, in timer ticks
+ * (or NO_TRANSMIT_LATENCY, until that transmission starts).
+ */
+static volatile uint32_t continuous_transmission_started_at;
+static volatile uint32_t first_transmit_latency = NO_TRANSMIT_LATENCY;
+
 /**
  * Static "pseudo-global" that stores the function which should be called on a
  * succesful reciept of IR data.
@@ -79,6 +146,18 @@ static volatile TransmitProvider transmit_provider = 0;
 static uint8_t ir_receive_enabled = 0;
 
 
+/**
+ * The receiver is left on while we transmit, so it hears our own
+ * transmissions. These store the most recently transmitted byte, whose
+ * echo we should ignore; how many of its echoes we're still expecting
+ * (more than one, in a burst); and when its transmission finished,
+ * or zero if it's still in progress.
+ */
+static volatile uint8_t echo_value;
+static volatile uint8_t echo_expected = 0;
+static volatile uint32_t echo_transmitted_at = 0;
+
+
 /**
  * Sets up Timer 3 to produce a 38kHz "carrier" square wave,
  * for use in IR communications. This is externally AND'd with
@@ -96,10 +175,9 @@ static void set_up_uart();
 
 
 /**
- * Sends the "continuous transmission" value; this should
- * be called repeatedly to enact continuous transmission mode.
+ * Programs the UART with the current signaling rate.
  */
-static void ir_perform_continuous_transmission();
+static void apply_baud_rate();
 
 
 /**
@@ -108,6 +186,11 @@ static void ir_perform_continuous_transmission();
  */
 void set_up_ir_comm() {
 
+  //Set up the timers module, which drives continuous transmission.
+  //Note that this function is idempotent, and thus won't clash with any other
+  //units which are using the timers library.
+  set_up_timers();
+
   //Set up the internal PWM timer to create our carrier wave.
   set_up_modulation();
 
@@ -195,9 +278,9 @@ void set_up_uart() {
   //8 bits of data; no parity; one stop bit.
 	UCSR1C = (1 << UCSZ11) | (1 << UCSZ10);
 
-  //Compute the baud rate, determining the UART counter value which will
-  //trigger a send/receive event. See page 189 of the AtMega32u4 datasheet.
-  UBRR1 = (F_CPU / (16UL * uart_baud_rate)) - 1;
+  //Apply the baud rate, determining the UART counter value which will
+  //trigger a send/receive event.
+  apply_baud_rate();
 
   //Enable the "transmission complete" interrupt.
   UCSR1A |= (1 << TXC1);
@@ -207,6 +290,64 @@ void set_up_uart() {
 }
 
 
+/**
+ * Programs the UART with the current signaling rate.
+ * See page 189 of the AtMega32u4 datasheet.
+ */
+static void apply_baud_rate() {
+
+  uint16_t rate = supported_baud_rates[baud_rate_index];
+
+  //UBRR1 is a sixteen-bit register, and so must be written atomically.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    UBRR1 = (F_CPU / (16UL * rate)) - 1;
+  }
+}
+
+
+/**
+ * Switches the UART to the given signaling rate, which must be one of the
+ * supported rates; returns false (leaving the rate unchanged) if it isn't.
+ * A byte which is being sent or received as the rate changes is garbled.
+ */
+bool ir_set_baud_rate(uint16_t rate) {
+
+  uint8_t i;
+
+  for(i = 0; i < SUPPORTED_BAUD_RATE_COUNT; ++i) {
+    if(supported_baud_rates[i] == rate) {
+      baud_rate_index = i;
+      apply_baud_rate();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+/**
+ * Switches the UART to the next slower supported signaling rate, wrapping
+ * from the slowest to the fastest; used to search for another device's rate,
+ * which is most often lowered a step at a time. Returns the new rate.
+ */
+uint16_t ir_step_baud_rate() {
+
+  baud_rate_index = baud_rate_index ? (baud_rate_index - 1) : (SUPPORTED_BAUD_RATE_COUNT - 1);
+
+  apply_baud_rate();
+  return supported_baud_rates[baud_rate_index];
+}
+
+
+/**
+ * Returns the UART's current signaling rate, in baud.
+ */
+uint16_t ir_get_baud_rate() {
+  return supported_baud_rates[baud_rate_index];
+}
+
+
 /**
  * Enables receipt of IR data.
  */ 
@@ -249,41 +390,242 @@ void ir_disable_receive_until_transmit_complete() {
 }
 
 
+/**
+ * Returns the number of ticks until our slot next starts. Called only
+ * when a slotted schedule is in use.
+ */
+static uint16_t ticks_until_transmit_slot() {
+
+  int32_t position_in_slot_frame;
+
+  //Find where we are in the frame, measuring from the start of our slot.
+  //(The frame may have been aligned shortly after startup, or our slot may
+  //not have started yet; so the difference can be negative.)
+  position_in_slot_frame = (int32_t)(timer_ticks() - transmit_frame_started_at - transmit_slot) % transmit_frame_length;
+  if(position_in_slot_frame < 0) {
+    position_in_slot_frame += transmit_frame_length;
+  }
+
+  //... and wait for the start of the next one. If our slot is just starting,
+  //we're most likely being called from within it; wait for the next frame.
+  return transmit_frame_length - position_in_slot_frame;
+}
+
+
+/**
+ * Returns the number of ticks until the first burst of continuous
+ * transmission should start: immediately, unless we have to wait for our slot.
+ */
+static uint16_t ticks_until_first_burst() {
+  return transmit_frame_length ? ticks_until_transmit_slot() : 1;
+}
+
+
 /**
  * Non-blocking function which begins a process of repeatedly transmitting
- * a single value. This is driven by interrupts, and thus effecitvely runs
- * "in the background".
+ * values from the transmit provider, according to the transmit schedule
+ * (see ir_set_transmit_interval, below). This is driven by interrupts,
+ * and thus effecitvely runs "in the background".
  *
- * Note that the baud rate may need to be relatively low to ensure
- * that the other end can keep up with all the data we're sending!
+ * The first burst starts on the next timer tick (or at the start of our
+ * next slot, if slotting is enabled), rather than a full interval from now;
+ * ir_first_transmit_latency reports the actual delay.
  */
 void ir_start_continuously_transmitting() {
 
-  //Sets up the IR "continous transmission" function such that
-  //it will be called approximately once per second.
-  register_slow_tick_handler(ir_perform_continuous_transmission);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    //Restart the schedule from scratch...
+    cancel_timer_event(next_burst);
+
+    continuously_transmitting = 1;
+    continuous_transmission_started_at = timer_ticks();
+    first_transmit_latency = NO_TRANSMIT_LATENCY;
+
+    //... with the first burst as soon as possible.
+    next_burst = schedule_timer_event(ir_perform_continuous_transmission, ticks_until_first_burst());
+  }
+}
+
+
+/**
+ * Returns the number of ticks until the next burst should start: the start
+ * of our next slot, if slotting is enabled; otherwise, the transmit interval,
+ * randomly adjusted by up to the transmit jitter.
+ */
+static uint16_t ticks_until_next_burst() {
+
+  uint16_t interval = transmit_interval, jitter = transmit_jitter;
+  uint32_t ticks;
 
+  if(transmit_frame_length) {
+    return ticks_until_transmit_slot();
+  }
+
+  //Keep the interval positive, however much jitter we've been asked for.
+  if(jitter >= interval) {
+    jitter = interval - 1;
+  }
+
+  if(!jitter) {
+    return interval;
+  }
+
+  //Pick an offset between -jitter and +jitter; the result may not fit
+  //in a timer event's delay, so it's limited to the longest delay possible.
+  ticks = interval - jitter + ((((uint16_t)random_byte() << 8) | random_byte()) % (2UL * jitter + 1));
+  return (ticks > 0xFFFF) ? 0xFFFF : ticks;
 }
 
 
 /**
- * Sends the "continuous transmission" value; this should
- * be called repeatedly to enact continuous transmission mode.
+ * Starts a single burst of continuous transmission, and schedules the next.
+ * Called from the timer dispatch interrupt.
  */
-static void ir_perform_continuous_transmission() {
+void ir_perform_continuous_transmission() {
+
+  uint8_t value;
+
+  next_burst = NO_TIMER_EVENT;
 
-  //If we don't have a transmission provider function,
-  //return without transmitting.
-  if(!transmit_provider) {
+  //If we're not in continuous transmission mode, or we don't have a
+  //transmission provider function, return without transmitting.
+  if(!continuously_transmitting || !transmit_provider) {
     return;
   }
 
-  //Transmit the value provided by our "transmit provider"
-  //function.
-  ir_transmit(transmit_provider());
+  next_burst = schedule_timer_event(ir_perform_continuous_transmission, ticks_until_next_burst());
 
+  //If the previous burst is still on the air (the schedule is tighter than
+  //the baud rate allows), skip this one rather than garble it.
+  if(transmitting) {
+    return;
+  }
+
+  if(first_transmit_latency == NO_TRANSMIT_LATENCY) {
+    first_transmit_latency = timer_ticks() - continuous_transmission_started_at;
+  }
+
+  //Transmit the value provided by our "transmit provider" function;
+  //the rest of the burst repeats it, as each transmission completes.
+  value = transmit_provider();
+  burst_transmissions_remaining = transmit_burst_length - 1;
+  ir_transmit(value);
+
+}
+
+
+/**
+ * Sets the interval between the starts of successive bursts of continuous
+ * transmission, in timer ticks; at least one. Takes effect from the next burst.
+ * Returns the interval applied.
+ */
+uint16_t ir_set_transmit_interval(uint16_t interval) {
+  transmit_interval = interval ? interval : 1;
+  return transmit_interval;
+}
+
+
+/**
+ * Sets the number of times each value is transmitted, back to back, in a
+ * single burst; at least one. Returns the burst length applied.
+ */
+uint8_t ir_set_transmit_burst_length(uint8_t burst_length) {
+  transmit_burst_length = burst_length ? burst_length : 1;
+  return transmit_burst_length;
+}
+
+
+/**
+ * Sets the largest amount by which each interval between bursts is
+ * randomly lengthened or shortened, in timer ticks. Jitter of at least the
+ * interval itself is reduced to just under the interval when applied.
+ * Returns the jitter applied.
+ */
+uint16_t ir_set_transmit_jitter(uint16_t jitter) {
+  transmit_jitter = jitter;
+  return transmit_jitter;
+}
+
+
+/**
+ * Moves the next burst of continuous transmission (if we're transmitting)
+ * to fit a change in the schedule. Must be called with interrupts disabled.
+ */
+static void reschedule_next_burst() {
+
+  if(!continuously_transmitting) {
+    return;
+  }
+
+  cancel_timer_event(next_burst);
+  next_burst = schedule_timer_event(ir_perform_continuous_transmission, ticks_until_next_burst());
+}
+
+
+/**
+ * Sets the length of the frame used for slotted transmission, in timer ticks;
+ * or disables slotted transmission, if the length is zero. While slotting is
+ * enabled, one burst is sent per frame, in our slot; the transmit interval
+ * and jitter are ignored. Returns the frame length applied.
+ */
+uint16_t ir_set_transmit_frame_length(uint16_t frame_length) {
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    transmit_frame_length = frame_length;
+    reschedule_next_burst();
+  }
+
+  return frame_length;
+}
+
+
+/**
+ * Sets the start of our slot, measured from the start of each frame,
+ * in timer ticks. Returns the slot applied.
+ */
+uint16_t ir_set_transmit_slot(uint16_t slot) {
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    transmit_slot = slot;
+    reschedule_next_burst();
+  }
+
+  return slot;
+}
+
+
+/**
+ * Aligns our frames with those of the other beacons on the field, given
+ * how far into the current frame the host's shared clock is, in timer ticks.
+ * This should be repeated from time to time, as our clocks drift apart.
+ */
+void ir_synchronize_transmit_frame(uint32_t ticks_into_frame) {
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    transmit_frame_started_at = timer_ticks() - ticks_into_frame;
+    reschedule_next_burst();
+  }
 }
 
+
+/**
+ * Returns the delay between the most recent start of continuous transmission
+ * and its first transmission, in timer ticks; or NO_TRANSMIT_LATENCY if
+ * nothing has been transmitted since.
+ */
+uint32_t ir_first_transmit_latency() {
+
+  uint32_t latency;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    latency = first_transmit_latency;
+  }
+
+  return latency;
+}
+
+
 /**
  * Transmits the given value over the board's IR.
  */ 
@@ -292,12 +634,21 @@ void ir_transmit(uint8_t value) {
   //Ensure modulation is on, so we can transmit via our IR carrier.
   enable_modulation();
 
-  //Ensure that we don't try to receive during transmit.
-  ir_disable_receive_until_transmit_complete();
+  //Leave the receiver on, so a robot can respond while we're transmitting;
+  //but arrange to ignore the echo of the byte we're sending. A burst
+  //repeats the same byte, so we may expect more than one echo.
+  if(!transmitting || value != echo_value) {
+    echo_expected = 0;
+  }
+  echo_value = value;
+  echo_transmitted_at = 0;
+  ++echo_expected;
 
   //Push the desired value into the UART data register,
   //queuing it for transmission.
+  transmitting = 1;
   UDR1 = value;
+  count_event(COUNTER_IR_TRANSMISSIONS);
 
 }
 
@@ -309,8 +660,15 @@ void ir_transmit(uint8_t value) {
  */
 void ir_stop_transmitting() {
 
-  //Disable the slow tick handler, disabling any current continuous transmission.
-  register_slow_tick_handler(0); 
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    //Leave continuous transmission mode, abandoning any burst in progress.
+    continuously_transmitting = 0;
+    burst_transmissions_remaining = 0;
+
+    cancel_timer_event(next_burst);
+    next_burst = NO_TIMER_EVENT;
+  }
 
 }
 
@@ -356,27 +714,85 @@ void register_transmit_provider(TransmitProvider provider) {
 ISR(USART1_TX_vect) {
 //ISR(USART1_UDRE_vect) {
 
+  PROFILE_ISR(PROFILE_IR_TRANSMIT);
+
+  //Note when our transmission finished, so we know how long to keep
+  //expecting its echo. (Zero is reserved to mean "still in progress".)
+  echo_transmitted_at = timer_ticks() | 1;
+
   //If receipt should be enabled, but we've disabled reciept
   //during transmission, re-enable receipt.
   if(ir_receive_enabled) {
     ir_enable_receive();
   }
 
+  //If we're partway through a burst, send the same value again.
+  if(burst_transmissions_remaining) {
+    --burst_transmissions_remaining;
+    ir_transmit(echo_value);
+  } else {
+    transmitting = 0;
+  }
+
+}
+
+/**
+ * Returns true iff the given received byte is the echo of our own
+ * transmission; if it is, we stop expecting the echo.
+ */
+static inline uint8_t is_own_echo(uint8_t received) {
+
+  //If we're not expecting an echo, this can't be one...
+  if(!echo_expected) {
+    return 0;
+  }
+
+  //... and if our transmission finished long enough ago, we've missed it.
+  //(The difference is signed: the stamp's low bit is forced on, so it can
+  //run a tick ahead of a byte which arrives right as the transmission ends.)
+  if(echo_transmitted_at && (int32_t)(timer_ticks() - echo_transmitted_at) > echo_guard_ticks) {
+    echo_expected = 0;
+    return 0;
+  }
+
+  //Otherwise, anything other than our own byte (e.g. a robot's response,
+  //or a byte garbled by a collision) is a genuine receipt.
+  if(received != echo_value) {
+    return 0;
+  }
+
+  --echo_expected;
+  return 1;
 }
 
+
 /**
  * Interrupt handler which is executed whenever the UART
  * receives a valid piece of data.
  */
 ISR(USART1_RX_vect) {
 
+  PROFILE_ISR(PROFILE_IR_RECEIVE);
+
+  //Determine if a framing error has occurred. The error flag describes
+  //the byte currently in the receive buffer, so it must be read first.
+  uint8_t framing_error = UCSR1A & (1 << FE1);
+
   //Always read in the value that was received,
   //as this has the side effect of allowing reciept
   //to continue.
   uint8_t received = UDR1;
 
-  //Determine if a framing error has occurred.
-  uint8_t framing_error = UCSR1A & FE1;
+  //Ignore the echo of our own transmissions.
+  if(!framing_error && is_own_echo(received)) {
+    count_event(COUNTER_IR_ECHOES);
+    return;
+  }
+
+  count_event(COUNTER_IR_BYTES_RECEIVED);
+  if(framing_error) {
+    count_event(COUNTER_IR_FRAMING_ERRORS);
+  }
 
   //Handle data that has been received correctly...
   if(!framing_error && receive_handler) {
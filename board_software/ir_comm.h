@@ -30,6 +30,7 @@
 #ifndef __IR_COMM_H__
 #define __IR_COMM_H__
 
+#include <stdbool.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
@@ -54,6 +55,23 @@ typedef uint8_t (*TransmitProvider)();
  */ 
 void set_up_ir_comm();
 
+/**
+ * Switches the UART to the given signaling rate: 300, 600, 1200, 2400, or
+ * 4800 baud. Returns false (leaving the rate unchanged) for any other rate.
+ */
+bool ir_set_baud_rate(uint16_t rate);
+
+/**
+ * Switches the UART to the next slower supported signaling rate, wrapping
+ * from the slowest to the fastest. Returns the new rate.
+ */
+uint16_t ir_step_baud_rate();
+
+/**
+ * Returns the UART's current signaling rate, in baud.
+ */
+uint16_t ir_get_baud_rate();
+
 /**
  * Enables receipt of IR data.
  */ 
@@ -77,14 +95,79 @@ void ir_disable_receive();
  */ 
 void ir_disable_receive_until_transmit_complete();
 
+/**
+ * The value reported by ir_first_transmit_latency when nothing has been
+ * transmitted since continuous transmission was last started.
+ */
+#define NO_TRANSMIT_LATENCY 0xFFFFFFFFUL
+
 /**
  * Non-blocking function which begins a process of repeatedly transmitting
+ * values from the transmit provider, according to the transmit schedule.
  * This is driven by interrupts, and thus effecitvely runs "in the background".
+ * The first value is sent on the next timer tick, or in our next slot.
  */ 
 void ir_start_continuously_transmitting();
 
+/**
+ * Sends a burst of "continuous transmission" values, if continuous
+ * transmission is enabled, and schedules the next burst.
+ */
+void ir_perform_continuous_transmission();
+
+/**
+ * Sets the interval between the starts of successive bursts of continuous
+ * transmission, in timer ticks; by default, one second. Returns the interval
+ * applied.
+ */
+uint16_t ir_set_transmit_interval(uint16_t interval);
+
+/**
+ * Sets the number of times each value is transmitted, back to back, in a
+ * single burst; by default, once. Returns the burst length applied.
+ */
+uint8_t ir_set_transmit_burst_length(uint8_t burst_length);
+
+/**
+ * Sets the largest amount by which each interval between bursts is randomly
+ * lengthened or shortened, in timer ticks; by default, zero. Returns the
+ * jitter applied.
+ */
+uint16_t ir_set_transmit_jitter(uint16_t jitter);
+
+/**
+ * Sets the length of the shared frame used for slotted transmission, in
+ * timer ticks; or disables slotted transmission, if the length is zero.
+ * While slotting is enabled, one burst is sent per frame, at the start of
+ * our slot. Returns the frame length applied.
+ */
+uint16_t ir_set_transmit_frame_length(uint16_t frame_length);
+
+/**
+ * Sets the start of our slot, measured from the start of each frame,
+ * in timer ticks. Returns the slot applied.
+ */
+uint16_t ir_set_transmit_slot(uint16_t slot);
+
+/**
+ * Aligns our frames with those of the other beacons on the field, given
+ * how far into the current frame the host's shared clock is, in timer ticks.
+ */
+void ir_synchronize_transmit_frame(uint32_t ticks_into_frame);
+
+/**
+ * Returns the delay between the most recent start of continuous transmission
+ * and its first transmission, in timer ticks; or NO_TRANSMIT_LATENCY if
+ * nothing has been transmitted since.
+ */
+uint32_t ir_first_transmit_latency();
+
 /**
  * Transmits the given value over the board's IR.
+ *
+ * The receiver remains enabled during transmission; the echo of the
+ * transmitted byte (if it's heard) is discarded, but any other byte
+ * received meanwhile is handled as usual.
  */ 
 void ir_transmit(uint8_t value);
 
@@ -27,12 +27,126 @@
  * THE SOFTWARE.
  */
 
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
 #include "lights.h"
 
-//static const uint16_t cycles_per_pwm = 512;
+/**
+ * The PWM frequency used until set_light_pwm_frequency is called, in Hz.
+ * This is well above the rate at which cameras (or eyes) perceive flicker.
+ */
+static const uint32_t default_pwm_frequency = 8000;
+
+/**
+ * The shortest PWM period (in CPU cycles, less one) which still
+ * allows each of the 256 brightness levels to be distinguished.
+ */
+static const uint16_t minimum_pwm_top = 255;
 
 volatile static uint8_t current_light_mask = 0;
-volatile static uint8_t percent_brightness = 100;
+
+/**
+ * The brightness of each of the lights, from 0 (off) to 255 (fully on),
+ * indexed by the light's offset from the white light's pin.
+ */
+volatile static uint8_t brightness[3] = { 255, 255, 255 };
+
+/**
+ * The current TOP value for Timer 1, which determines the PWM period.
+ */
+volatile static uint16_t pwm_top;
+
+/**
+ * The brightness most recently requested via set_light_brightness, which
+ * is restored whenever no effect is playing.
+ */
+volatile static uint8_t base_brightness = 255;
+
+
+/**
+ * Maps perceived brightness (0-255) onto PWM duty cycle (0-255),
+ * correcting for the eye's non-linear response (gamma = 2.2).
+ */
+static const uint8_t gamma_table[256] PROGMEM = {
+    0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+    3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+    6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+   12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+   20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+   30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+   42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+   56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+   73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+   91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+  113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+  137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+  163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+  192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+  223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+};
+
+/**
+ * A slow, two-second "breath" between moderate and full brightness.
+ */
+static const uint8_t breathing_keyframes[128] PROGMEM = {
+   96,  96,  96,  97,  98,  98,  99, 101, 102, 104, 105, 107, 109, 112, 114, 117,
+  119, 122, 125, 128, 131, 135, 138, 142, 145, 149, 152, 156, 160, 164, 168, 172,
+  176, 179, 183, 187, 191, 195, 199, 202, 206, 209, 213, 216, 220, 223, 226, 229,
+  232, 234, 237, 239, 242, 244, 246, 247, 249, 250, 252, 253, 253, 254, 255, 255,
+  255, 255, 255, 254, 253, 253, 252, 250, 249, 247, 246, 244, 242, 239, 237, 234,
+  232, 229, 226, 223, 220, 216, 213, 209, 206, 202, 199, 195, 191, 187, 183, 179,
+  176, 172, 168, 164, 160, 156, 152, 149, 145, 142, 138, 135, 131, 128, 125, 122,
+  119, 117, 114, 112, 109, 107, 105, 104, 102, 101,  99,  98,  98,  97,  96,  96
+};
+
+/**
+ * Four quick flashes, played once when the beacon is claimed.
+ */
+static const uint8_t claim_flash_keyframes[32] PROGMEM = {
+  255, 255, 255, 255,   0,   0,   0,   0, 255, 255, 255, 255,   0,   0,   0,   0,
+  255, 255, 255, 255,   0,   0,   0,   0, 255, 255, 255, 255,   0,   0,   0,   0
+};
+
+/**
+ * A sharp pulse which decays over one second, marking each second of a countdown.
+ */
+static const uint8_t countdown_keyframes[64] PROGMEM = {
+   64, 128, 191, 255, 231, 209, 189, 171, 155, 140, 127, 115, 104,  94,  85,  77,
+   69,  63,  57,  51,  47,  42,  38,  35,  31,  28,  26,  23,  21,  19,  17,  16,
+   14,  13,  11,  10,   9,   9,   8,   7,   6,   6,   5,   5,   4,   4,   3,   3,
+    3,   3,   2,   2,   2,   2,   2,   1,   1,   1,   1,   1,   1,   1,   1,   1
+};
+
+/**
+ * Describes a single light effect: a sequence of keyframes, each of which is
+ * shown for one frame (1/LIGHT_EFFECT_FRAME_RATE seconds).
+ */
+struct light_effect_definition {
+  const uint8_t *keyframes;
+  uint8_t length;
+};
+
+/**
+ * The keyframes for each of the effects, indexed by enum light_effect.
+ */
+static const struct light_effect_definition effects[] = {
+  [LightEffectNone]       = { 0, 0 },
+  [LightEffectBreathing]  = { breathing_keyframes,   sizeof(breathing_keyframes) },
+  [LightEffectClaimFlash] = { claim_flash_keyframes, sizeof(claim_flash_keyframes) },
+  [LightEffectCountdown]  = { countdown_keyframes,   sizeof(countdown_keyframes) }
+};
+
+/**
+ * The effect which loops in the background, and the one-shot effect
+ * (if any) which is currently playing over it; along with their positions.
+ */
+volatile static uint8_t background_effect = LightEffectNone;
+volatile static uint8_t background_frame = 0;
+volatile static uint8_t overlay_effect = LightEffectNone;
+volatile static uint8_t overlay_frame = 0;
+
 
 /**
  * Configures the AVR so it can control each of the
@@ -40,30 +154,122 @@ volatile static uint8_t percent_brightness = 100;
  */
 void set_up_lights() {
 
-  //Set the light pins to output mode.
+  //Set the light pins to output mode, with all lights off.
   LIGHT_DDR |= ((1 << WHITE_LIGHT_PIN) | (1 << GREEN_LIGHT_PIN) | (1 << RED_LIGHT_PIN));
+  LIGHT_PORT &= ~((1 << WHITE_LIGHT_PIN) | (1 << GREEN_LIGHT_PIN) | (1 << RED_LIGHT_PIN));
+
+  //Set up Timer 1 to generate our PWM: in Fast PWM mode with ICR1 as TOP
+  //(mode 14), counting CPU cycles without prescaling. The red and green lights
+  //sit on the timer's output compare pins (OC1A and OC1B), so the hardware
+  //dims them for us; each is connected to its compare unit when it's lit.
+  TCCR1A = (1 << WGM11);
+  TCCR1B = (1 << WGM13) | (1 << WGM12) | (1 << CS10);
+
+  set_light_pwm_frequency(default_pwm_frequency);
 
-  //Set up the timers, which handle PWM.
+  //Set up the timers, which advance the light effects by calling
+  //advance_light_effects periodically (see tick_handlers.h).
   //Note that this function is idempotent, and thus won't clash with any other
   //units which are using the timers library.
   set_up_timers();
+}
+
+
+/**
+ * Returns the compare value which produces the given brightness
+ * at the current PWM period.
+ */
+static uint16_t duty_cycle_for(uint8_t level) {
+
+  //A compare value equal to TOP keeps the output high for the whole period.
+  if(level == 255) {
+    return pwm_top;
+  }
+
+  return ((uint32_t)level * ((uint32_t)pwm_top + 1)) >> 8;
+}
+
+
+/**
+ * Applies the current state of the given light to the hardware, at the
+ * given brightness, which produces the given compare value.
+ */
+static void drive_light(enum color light_color, uint8_t level, uint16_t duty_cycle) {
+
+  uint8_t mask = 1 << light_color;
+
+  //A light which is off (or dimmed all the way down) is simply driven low.
+  bool lit = (current_light_mask & mask) && level;
+
+  //Timer 1's sixteen-bit registers share a single temporary register,
+  //so they can't safely be updated with interrupts enabled.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    switch(light_color) {
+
+      //The red and green lights are driven directly by the compare units.
+      case Red:
+        OCR1A = duty_cycle;
+        TCCR1A = lit ? (TCCR1A | (1 << COM1A1)) : (TCCR1A & ~(1 << COM1A1));
+        break;
+
+      case Green:
+        OCR1B = duty_cycle;
+        TCCR1A = lit ? (TCCR1A | (1 << COM1B1)) : (TCCR1A & ~(1 << COM1B1));
+        break;
+
+      //The white light has no compare output, so compare unit C instead
+      //interrupts to turn it off, and the overflow interrupt turns it back
+      //on. These only run while the white light is lit and partially dimmed;
+      //once they're running, only they drive the pin, so a change of level
+      //(e.g. each frame of an effect) can't turn the light on mid-period.
+      case White:
+        OCR1C = duty_cycle;
+
+        if(lit && level != 255) {
+          if(!(TIMSK1 & (1 << OCIE1C))) {
+            TIFR1 = (1 << TOV1) | (1 << OCF1C);
+            TIMSK1 |= (1 << TOIE1) | (1 << OCIE1C);
+
+            if(TCNT1 < duty_cycle) {
+              LIGHT_PORT |= mask;
+            }
+          }
+        } else {
+          TIMSK1 &= ~((1 << TOIE1) | (1 << OCIE1C));
+
+          if(lit) {
+            LIGHT_PORT |= mask;
+          }
+        }
+        break;
+    }
 
-  //Register our PWM timer handler, so the internal timers module
-  //will call it regularly, and we can dim LEDs.
-  register_fast_tick_handler(handle_pwm_timer_event);
+    if(!lit) {
+      LIGHT_PORT &= ~mask;
+    }
+  }
+}
 
+/**
+ * Applies the current state and brightness of the given light to the hardware.
+ */
+static void update_light(enum color light_color) {
+  uint8_t level = brightness[light_color - White];
+  drive_light(light_color, level, duty_cycle_for(level));
 }
 
+
 /**
  * Turns on the light of the specified color; all other lights remain as they were.
  */
 void turn_on_light(enum color light_color) {
 
-  //Adust the mask which determines the currently active LEDs.
+  //Adust the mask which determines the currently active LEDs...
   current_light_mask |= 1 << light_color;
 
-  //And "turn on" all of the currently active LEDs.
-  LIGHT_PORT |= current_light_mask;
+  //... and start driving the given light.
+  update_light(light_color);
 }
 
 /**
@@ -71,7 +277,7 @@ void turn_on_light(enum color light_color) {
  */
 void turn_off_light(enum color light_color) {
   current_light_mask &= ~(1 << light_color);
-  LIGHT_PORT &= ~(1 << light_color);
+  update_light(light_color);
 }
 
 /**
@@ -85,33 +291,171 @@ void turn_off_lights() {
 }
 
 /**
- * Sets the percent brightness of the given light.
+ * Sets the brightness of a single light, from 0 (off) to 255 (fully on).
+ */
+void set_color_brightness(enum color light_color, uint8_t level) {
+  brightness[light_color - White] = level;
+  update_light(light_color);
+}
+
+/**
+ * Applies a single brightness to all of the lights. This runs on every
+ * frame of an effect, so the compare value is only computed once.
  */
-void set_light_brightness(uint8_t percent) {
-  percent_brightness = percent;
+static void set_all_brightnesses(uint8_t level) {
+
+  uint16_t duty_cycle = duty_cycle_for(level);
+  uint8_t i;
+
+  for(i = 0; i < sizeof(brightness); ++i) {
+    brightness[i] = level;
+  }
+
+  drive_light(White, level, duty_cycle);
+  drive_light(Red, level, duty_cycle);
+  drive_light(Green, level, duty_cycle);
 }
 
+/**
+ * Sets the brightness of all of the lights, from 0 (off) to 255 (fully on).
+ * If an effect is playing, the brightness takes effect once it's stopped.
+ */
+void set_light_brightness(uint8_t level) {
+
+  base_brightness = level;
+
+  if(background_effect == LightEffectNone && overlay_effect == LightEffectNone) {
+    set_all_brightnesses(level);
+  }
+}
 
 /**
- * Handles PWM timer events, which occur roughly 150 times
- * per second; these events are used to enact dimming of
- * the board's LEDS.
+ * Sets the frequency of the PWM used to dim the lights, in Hz. The frequency
+ * is limited to the range in which all 256 brightness levels are distinct
+ * (roughly 245Hz to 62.5kHz at 16MHz).
  */
-void handle_pwm_timer_event() {
+void set_light_pwm_frequency(uint32_t frequency) {
 
-  static uint8_t ticks = 0;
+  uint32_t top = frequency ? (F_CPU / frequency) - 1 : 0xFFFF;
 
-  //Count a single overflow "tick".
-  ticks = (ticks + 1) % 100;
+  //Keep the period within the range of our sixteen-bit timer...
+  if(top > 0xFFFF) {
+    top = 0xFFFF;
+  }
+  //... and long enough to preserve our resolution.
+  if(top < minimum_pwm_top) {
+    top = minimum_pwm_top;
+  }
 
-  //If we've reached the turn-off time, disable the light.
-  if(ticks == percent_brightness) {
-    LIGHT_PORT &= ~current_light_mask;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    pwm_top = top;
+    ICR1 = top;
   }
-  //Otheriwse, if we've just started a new cycle,
-  //turn the light on.
-  else if (ticks == 0) {
-    LIGHT_PORT |= current_light_mask;
+
+  //Recompute each of the duty cycles for the new period.
+  update_light(White);
+  update_light(Red);
+  update_light(Green);
+}
+
+
+/**
+ * Sets the effect which plays (repeatedly) on all of the lit lights. Setting
+ * the effect that's already playing has no effect, so this can be called
+ * each time the board's state is enforced; LightEffectNone returns the
+ * lights to the brightness set by set_light_brightness.
+ */
+void set_light_effect(enum light_effect effect) {
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    if(effect != background_effect) {
+      background_effect = effect;
+      background_frame = 0;
+
+      if(effect == LightEffectNone && overlay_effect == LightEffectNone) {
+        set_all_brightnesses(base_brightness);
+      }
+    }
   }
+}
 
+/**
+ * Plays the given effect once, over whichever effect is currently playing.
+ */
+void flash_light_effect(enum light_effect effect) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    overlay_effect = effect;
+    overlay_frame = 0;
+  }
+}
+
+/**
+ * Returns the given effect's keyframe at the given position,
+ * and advances the position, wrapping at the end of the effect.
+ */
+static uint8_t next_keyframe(uint8_t effect, volatile uint8_t *frame) {
+
+  uint8_t keyframe = pgm_read_byte(&effects[effect].keyframes[*frame]);
+
+  if(++*frame >= effects[effect].length) {
+    *frame = 0;
+  }
+
+  return keyframe;
+}
+
+/**
+ * Advances the light effects by a single frame. This is called from the
+ * timer dispatch interrupt LIGHT_EFFECT_FRAME_RATE times per second. Each
+ * frame looks up a keyframe and its gamma-corrected level, computes one
+ * compare value (a 32-bit multiply), and updates the three lights' compare
+ * registers, each briefly with interrupts masked.
+ */
+void advance_light_effects() {
+
+  uint8_t perceived_brightness;
+
+  //A one-shot effect takes precedence over the background effect;
+  //once it's wrapped around, it's done.
+  if(overlay_effect != LightEffectNone) {
+    perceived_brightness = next_keyframe(overlay_effect, &overlay_frame);
+
+    if(!overlay_frame) {
+      overlay_effect = LightEffectNone;
+    }
+  } else if(background_effect != LightEffectNone) {
+    perceived_brightness = next_keyframe(background_effect, &background_frame);
+  } else {
+    return;
+  }
+
+  //If that was the last frame of the last effect, restore the lights' steady
+  //brightness; otherwise, show the keyframe, corrected for the eye's response.
+  if(overlay_effect == LightEffectNone && background_effect == LightEffectNone) {
+    set_all_brightnesses(base_brightness);
+  } else {
+    set_all_brightnesses(pgm_read_byte(&gamma_table[perceived_brightness]));
+  }
+}
+
+
+/**
+ * Turns on the white light at the start of each PWM period.
+ */
+ISR(TIMER1_OVF_vect) {
+
+  //Compare C outranks the overflow; so if both were held off (e.g. by
+  //another interrupt) past a short duty cycle, the light's already been
+  //turned off for this period, and must stay off.
+  if(!(TIFR1 & (1 << OCF1C)) && TCNT1 < OCR1C) {
+    LIGHT_PORT |= (1 << WHITE_LIGHT_PIN);
+  }
+}
+
+/**
+ * Turns off the white light once its duty cycle has elapsed.
+ */
+ISR(TIMER1_COMPC_vect) {
+  LIGHT_PORT &= ~(1 << WHITE_LIGHT_PIN);
 }
@@ -30,7 +30,9 @@
 #ifndef __LIGHTS_H__
 #define __LIGHTS_H__
 
+#include <stdbool.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 #include "timers.h"
 
@@ -52,6 +54,21 @@ enum color {
   Green  = GREEN_LIGHT_PIN
 };
 
+/**
+ * The number of times per second that the light effects advance by a frame.
+ */
+#define LIGHT_EFFECT_FRAME_RATE 64
+
+/**
+ * The effects which can be played on the lights; see lights.c.
+ */
+enum light_effect {
+  LightEffectNone = 0,
+  LightEffectBreathing,
+  LightEffectClaimFlash,
+  LightEffectCountdown
+};
+
 
 /**
  * Configures the AVR so it can control each of the
@@ -75,16 +92,35 @@ void turn_off_light(enum color light_color);
 void turn_off_lights();
 
 /**
- * Sets the percent brightness of the given light.
+ * Sets the brightness of a single light, from 0 (off) to 255 (fully on).
+ */
+void set_color_brightness(enum color light_color, uint8_t level);
+
+/**
+ * Sets the brightness of all of the lights, from 0 (off) to 255 (fully on).
+ */
+void set_light_brightness(uint8_t level);
+
+/**
+ * Sets the frequency of the PWM used to dim the lights, in Hz.
+ */
+void set_light_pwm_frequency(uint32_t frequency);
+
+/**
+ * Sets the effect which plays (repeatedly) on all of the lit lights;
+ * or stops any such effect, if LightEffectNone is provided.
+ */
+void set_light_effect(enum light_effect effect);
+
+/**
+ * Plays the given effect once, over whichever effect is currently playing.
  */
-void set_light_brightness(uint8_t percent);
+void flash_light_effect(enum light_effect effect);
 
 /**
- * Handles PWM timer events, which occur roughly 150 times
- * per second; these events are used to enact dimming of
- * the board's LEDS.
+ * Advances the light effects by a single frame.
  */
-void handle_pwm_timer_event();
+void advance_light_effects();
 
 
 #endif
@@ -24,8 +24,8 @@
  */
 
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <stdbool.h>
-#include <stdlib.h>
 
 #include "usb_serial/usb_serial.h"
 #include "frequency.h"
@@ -35,15 +35,22 @@
 #include "lights.h"
 #include "ir_comm.h"
 #include "pc_comm.h"
+#include "work_queue.h"
+#include "claim_log.h"
+#include "counters.h"
+#include "profiler.h"
+#include "debug.h"
+#include "random.h"
+#include "claim_validator.h"
 
 #include "main.h"
 
 /**
  * The relative brightnesses for a bright and dim beacon LED,
- * in terms of percent duty cycle.
+ * on a scale from 0 (off) to 255 (fully on).
  */
-static const uint8_t Bright = 100;
-static const uint8_t Dim = 3;
+static const uint8_t Bright = 255;
+static const uint8_t Dim = 8;
 
 /**
  * Stores the current state for the board.
@@ -58,6 +65,11 @@ volatile static BoardState beacon = {.mode = MODE_OFF, .owner = OwnerNone};
  */
 volatile static uint8_t claim_code = 0;
 
+/**
+ * True iff the beacon is currently transmitting claim codes.
+ */
+volatile static bool transmitting_claim_codes = false;
+
 
 /**
  * Stores the most recent attempt at a beacon claim which has not been
@@ -66,11 +78,64 @@ volatile static uint8_t claim_code = 0;
 volatile static uint16_t last_claim_attempt = -1;
 
 /**
- * Constant which specifies the maximum allowed amount of bit errors
- * before the beacon can be claimed. If this is set to 8, the beacon
- * will always be claimed when IR is received.
+ * Specifies the maximum allowed amount of bit errors before the beacon
+ * can be claimed. If this is set to 8, the beacon will always be claimed
+ * when IR is received. Can be set by the PC; see set_parameter.
+ */
+volatile static uint8_t maximum_allowed_errors = 0;
+
+/**
+ * The events which the PC has asked us to push to it, as a mask of
+ * (1 << EVENT_...); see send_event_to_pc. Can be set by the PC; see
+ * set_parameter.
+ */
+volatile static uint8_t enabled_events = 0;
+
+/**
+ * The length of the shared transmit frame, in milliseconds, as last set
+ * by the PC; or zero, if slotted transmission is off. See set_parameter.
+ */
+volatile static uint16_t transmit_frame_milliseconds = 0;
+
+/**
+ * The layout of the argument which handle_IR_receive passes to
+ * process_claim_attempt: the received value in the low byte, its distance
+ * from the expected response in the next seven bits (saturating, so
+ * NO_CLAIM_CODE_DISTANCE becomes CLAIM_ATTEMPT_DISTANCE_MASK), and whether
+ * it was accepted in the top bit.
+ */
+#define CLAIM_ATTEMPT_DISTANCE_SHIFT 8
+#define CLAIM_ATTEMPT_DISTANCE_MASK  0x7F
+#define CLAIM_ATTEMPT_ACCEPTED       0x8000
+
+/**
+ * The times at which the claim attempts waiting for process_claim_attempt
+ * arrived, oldest first, so each can be logged (and reported to the PC)
+ * with the time it arrived, rather than the time it was judged.
+ * There can be no more of these than there is room for work.
+ */
+static uint32_t claim_arrival_times[WORK_QUEUE_SIZE];
+volatile static uint8_t claim_arrivals_head = 0;
+volatile static uint8_t claim_arrivals_count = 0;
+
+/**
+ * The longest the PC can schedule a mode change in advance, in milliseconds.
+ */
+#define MAXIMUM_MODE_CHANGE_DELAY (60UL * 60UL * 1000UL)
+
+/**
+ * The length of a timer tick, in microseconds.
+ */
+#define MICROSECONDS_PER_TICK (1000000UL / TIMER_TICKS_PER_SECOND)
+
+/**
+ * A mode change which has been scheduled by the PC (see schedule_mode_change),
+ * the timer tick on which it's due, and the timer event which is waiting for it.
  */
-static const uint8_t maximum_allowed_errors = 0;
+volatile static bool mode_change_scheduled = false;
+volatile static uint8_t scheduled_mode;
+volatile static uint32_t scheduled_mode_due;
+volatile static TimerEvent scheduled_mode_event = NO_TIMER_EVENT;
 
 
 /**
@@ -94,10 +159,13 @@ int main() {
   register_transmit_provider(value_to_transmit);
 
   //Handle communications with the host PC forever.
-  //Note that all other functions are interrupt driven;
-  //so PC communication is both the lowest priority and
-  //the only task running in the "main loop".
+  //Note that all other functions are interrupt driven; so PC communication
+  //is the lowest priority task running in the "main loop". The only other
+  //work done here is work deferred by the interrupt handlers, which keeps
+  //their run time short. Between requests, the CPU sleeps; see wait_for_work.
   while(1) {
+    wait_for_work();
+    run_pending_work();
     handle_pc_comm();
   }
 
@@ -124,10 +192,20 @@ void set_up_hardware() {
   //Set up all of the peripherals...
   set_up_lights();
   set_up_ir_comm();
+  set_up_isr_profiler();
+
+  //If tracing is built in, send the trace over the SPI port.
+#ifdef TRACING
+  enable_debug_backend();
+#endif
 
   //Set up the PC connection
   connect_to_pc();
 
+  //When we're idle, stop the CPU, but leave the peripherals running;
+  //any interrupt (including the USB receive interrupt) wakes us.
+  set_sleep_mode(SLEEP_MODE_IDLE);
+
   //And enable interrupts, starting the main device functions.
   sei();
 }
@@ -151,16 +229,16 @@ void pull_up_unused_pins() {
 
  
   //Apply the port values themselves.
-  DDRF  &= ~port_f_unused;
+  DDRF  &= (uint8_t)~port_f_unused;
   PORTF |=  port_f_unused;
 
-  DDRE  &= ~port_e_unused;
+  DDRE  &= (uint8_t)~port_e_unused;
   PORTE &=  port_e_unused;
 
-  DDRD  &= ~port_d_unused;
+  DDRD  &= (uint8_t)~port_d_unused;
   PORTD &=  port_d_unused;
 
-  DDRB  &= ~port_b_unused;
+  DDRB  &= (uint8_t)~port_b_unused;
   PORTB &=  port_b_unused;
 }
 
@@ -185,22 +263,108 @@ inline void connect_to_pc() {
 
 
 /**
- * Handles all requests (and commands) recieved from the PC.
+ * Sleeps until a request from the PC has been received, or an interrupt
+ * handler has deferred work to the main loop.
+ *
+ * Received data is queued by the USB interrupt, so this no longer
+ * polls the USB controller (which required masking interrupts).
+ */
+void wait_for_work() {
+
+  //Interrupts are disabled while we check for work, so none can
+  //arrive between the check and the sleep; sei() always allows the
+  //following instruction to execute before any interrupt is serviced.
+  cli();
+  while(!usb_serial_available() && !work_pending()) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+  sei();
+}
+
+
+/**
+ * Handles the requests (and commands) recieved from the PC.
+ *
+ * The requests which had already arrived when we were called are handled
+ * before we return, and the responses are sent together, in as few USB
+ * packets as possible. This allows the PC to send several (tagged) requests
+ * at once, rather than waiting for the response to each before sending the
+ * next. Requests which arrive in the meantime are left for the next batch,
+ * so a PC which keeps sending can't hold off the deferred work (e.g. claim
+ * attempts) which the main loop runs between batches.
  */
 void handle_pc_comm() {
 
-  BoardState new_state;
+  //Every request is at least a byte long, so the batch is no larger
+  //than the number of bytes that are waiting now.
+  uint8_t remaining = usb_serial_available();
+
+  //If we don't have a request, there's nothing to do...
+  if(!remaining) {
+    return;
+  }
+
+  begin_pc_response_batch();
 
-  //Wait until we have a request...
-  while(!usb_serial_available());
+  while(remaining-- && usb_serial_available()) {
+    handle_pc_request();
+  }
+
+  end_pc_response_batch();
+}
+
+
+/**
+ * Handles a single request (or command) from the PC.
+ *
+ * Any request can be tagged, by preceding it with REQUEST_TAGGED and a tag
+ * of the PC's choosing. The response to a tagged request is framed with
+ * its tag and length; see end_tagged_response.
+ */
+void handle_pc_request() {
+
+  BoardState new_state;
+  uint32_t received_milliseconds;
+  uint16_t received_microseconds;
+  uint8_t tagged_request[2];
+  bool tagged = false;
 
   //Receive the new board state.
   new_state = receive_state_from_pc();
+  received_milliseconds = uptime_milliseconds(&received_microseconds);
+  TRACE(TRACE_PC_REQUEST, new_state.raw_data);
+
+  //Stir the current value of Timer 1 (which is run by the light
+  //module) into the entropy pool. This allows us to use the PC
+  //communications' erratic timings as a source of randomness.
+  add_entropy(TCNT1);
+
+  //If this is a tagged request, receive the tag and the request itself.
+  if(new_state.mode == REQUEST_TAGGED) {
+
+    if(!receive_bytes_from_pc(tagged_request, sizeof(tagged_request))) {
+      return;
+    }
+
+    tagged = true;
+    new_state.raw_data = tagged_request[1];
+  }
+
+  //Hold back the response until it's complete, so it's sent as a whole.
+  begin_pc_response();
 
   //Perform an action based on the request given.
   switch(new_state.mode) 
   {
 
+    //Tags can't be nested; ignore the request.
+    case REQUEST_TAGGED:
+      break;
+
     //If the PC is requesting the most recent claim,
     //responsd with the most recent claim code; then
     //invalidate any pending claims.
@@ -208,6 +372,59 @@ void handle_pc_comm() {
       send_most_recent_claim_attempt();
       break;
 
+    //If the PC is requesting a snapshot of our status,
+    //send everything it'd otherwise have to ask for separately.
+    case REQUEST_SNAPSHOT:
+      send_snapshot();
+      break;
+
+    //If the PC is requesting the performance counters,
+    //send (and reset) them.
+    case REQUEST_COUNTERS:
+      send_counters();
+      break;
+
+    //If the PC is requesting the interrupt profiles,
+    //send (and reset) them.
+    case REQUEST_ISR_PROFILE:
+      send_isr_profiles();
+      break;
+
+    //If the PC is requesting the history of claim attempts,
+    //send every attempt that's been logged since it last asked.
+    case REQUEST_CLAIM_HISTORY:
+      send_claim_history();
+      break;
+
+    //If the PC is adjusting one of the beacon's parameters,
+    //apply it, and respond with the value that was applied.
+    case REQUEST_SET_PARAMETER:
+      receive_parameter();
+      break;
+
+    //If the PC is synchronizing its clock with ours,
+    //tell it when its request arrived, and when we responded.
+    case REQUEST_TIME_SYNC:
+      send_time_sync_to_pc(received_milliseconds, received_microseconds);
+      break;
+
+    //If the PC is scheduling a mode change, e.g. the end of a round,
+    //wait for the requested time to apply it.
+    case REQUEST_SCHEDULE_MODE:
+      receive_scheduled_mode();
+      break;
+
+    //If the PC is aligning the beacons' transmit slots, follow its clock.
+    case REQUEST_SYNC_TRANSMIT_FRAME:
+      receive_transmit_frame_sync();
+      break;
+
+    //If the PC is asking how quickly the first claim code went out
+    //after the beacon became claimable, tell it.
+    case REQUEST_TRANSMIT_LATENCY:
+      send_transmit_latency();
+      break;
+
     //If the PC is requesting the current claim code, send it.
     case REQUEST_CLAIM_CODE:
       send_byte_to_pc(claim_code);
@@ -222,14 +439,26 @@ void handle_pc_comm() {
     //If we weren't sent a request state, 
     //update the internal state, and transmit 
     //the state back to the PC as a primitive
-    //acknowledgement.
+    //acknowledgement. A change of mode supersedes any scheduled one;
+    //but the PC can still adjust e.g. the owner while a change is pending.
     default:
+      if(new_state.mode != beacon.mode) {
+        cancel_scheduled_mode_change();
+      }
       apply_state(new_state);
       send_state_to_pc(beacon);
       break;
   
   }
 
+  //The response is complete; send it to the PC now, rather than leaving
+  //it to the USB flush timeout.
+  if(tagged) {
+    end_tagged_response(tagged_request[0]);
+  } else {
+    end_pc_response();
+  }
+
 }
 
 /**
@@ -248,20 +477,386 @@ void send_most_recent_claim_attempt() {
 
 }
 
+/**
+ * Transmits a snapshot of the beacon's status to the PC, in a single packet:
+ * the board's state, the current claim code, and the most recent claim
+ * attempt as a word (as for REQUEST_LAST_CLAIM, which this invalidates);
+ * followed by a count of performance counters, and each of the counters'
+ * values as a word, which are left running. This lets the PC poll a board
+ * with a single round trip.
+ */
+void send_snapshot() {
+
+  uint8_t snapshot[5 + 2 * PERFORMANCE_COUNTER_COUNT];
+  uint16_t counters[PERFORMANCE_COUNTER_COUNT];
+  uint8_t i;
+
+  read_counters(counters);
+
+  //Capture the state and claim attempt together, so they're consistent.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    snapshot[0] = beacon.raw_data;
+    snapshot[1] = claim_code;
+    snapshot[2] = last_claim_attempt >> 8;
+    snapshot[3] = last_claim_attempt & 0xFF;
+    last_claim_attempt = no_new_claim_code;
+  }
+
+  snapshot[4] = PERFORMANCE_COUNTER_COUNT;
+  for(i = 0; i < PERFORMANCE_COUNTER_COUNT; ++i) {
+    snapshot[5 + 2 * i] = counters[i] >> 8;
+    snapshot[6 + 2 * i] = counters[i] & 0xFF;
+  }
+
+  send_bytes_to_pc(snapshot, sizeof(snapshot));
+}
+
+/**
+ * Receives a parameter adjustment from the PC, which follows the request:
+ * a parameter number (see state.h), and its new value, as a word. Applies
+ * the parameter, and responds with the value that was actually applied,
+ * or with NO_PARAMETER_VALUE if the request was invalid.
+ */
+void receive_parameter() {
+
+  uint8_t request[3];
+  uint16_t applied = NO_PARAMETER_VALUE;
+
+  if(receive_bytes_from_pc(request, sizeof(request))) {
+    applied = set_parameter(request[0], ((uint16_t)request[1] << 8) | request[2]);
+  }
+
+  send_word_to_pc(applied);
+}
+
+/**
+ * Sets one of the beacon's parameters. Values are limited to those the
+ * beacon supports; returns the value that was actually applied, or
+ * NO_PARAMETER_VALUE if the parameter is unknown.
+ */
+uint16_t set_parameter(uint8_t parameter, uint16_t value) {
+
+  switch(parameter) {
+
+    case PARAMETER_MAXIMUM_ALLOWED_ERRORS:
+      maximum_allowed_errors = (value > 8) ? 8 : value;
+      return maximum_allowed_errors;
+
+    case PARAMETER_CLAIM_WINDOW_SIZE:
+      return set_claim_window_size((value > 0xFF) ? 0xFF : value);
+
+    //The grace period is given in milliseconds, and limited to a minute;
+    //this also keeps the applied value from reading as NO_PARAMETER_VALUE.
+    case PARAMETER_CLAIM_GRACE_PERIOD:
+      value = (value > 60000) ? 60000 : value;
+      set_claim_grace_period((uint32_t)value * TIMER_TICKS_PER_SECOND / 1000);
+      return value;
+
+    case PARAMETER_CLAIM_RATE:
+      return set_claim_rate((value > 0xFF) ? 0xFF : value);
+
+    case PARAMETER_CLAIM_BURST:
+      return set_claim_burst((value > 0xFF) ? 0xFF : value);
+
+    //Only the rates in the IR module's table are accepted; robots
+    //(and any responder) must be switched to the same rate.
+    case PARAMETER_IR_BAUD_RATE:
+      return ir_set_baud_rate(value) ? value : NO_PARAMETER_VALUE;
+
+    //The transmit interval and jitter are given in milliseconds; intervals
+    //are limited to the longest a timer event can be delayed.
+    case PARAMETER_TRANSMIT_INTERVAL:
+      value = (value > 4000) ? 4000 : (value ? value : 1);
+      ir_set_transmit_interval((uint32_t)value * TIMER_TICKS_PER_SECOND / 1000);
+      return value;
+
+    case PARAMETER_TRANSMIT_BURST:
+      return ir_set_transmit_burst_length((value > 0xFF) ? 0xFF : value);
+
+    case PARAMETER_TRANSMIT_JITTER:
+      value = (value > 4000) ? 4000 : value;
+      ir_set_transmit_jitter((uint32_t)value * TIMER_TICKS_PER_SECOND / 1000);
+      return value;
+
+    //The slotted schedule's frame and slot are also given in milliseconds;
+    //a frame of zero returns to the interval-based schedule.
+    case PARAMETER_TRANSMIT_FRAME:
+      value = (value > 4000) ? 4000 : value;
+      transmit_frame_milliseconds = value;
+      ir_set_transmit_frame_length((uint32_t)value * TIMER_TICKS_PER_SECOND / 1000);
+      return value;
+
+    case PARAMETER_TRANSMIT_SLOT:
+      value = (value > 4000) ? 4000 : value;
+      ir_set_transmit_slot((uint32_t)value * TIMER_TICKS_PER_SECOND / 1000);
+      return value;
+
+    //Events are selected by a mask; any we don't know of are ignored.
+    case PARAMETER_EVENTS:
+      enabled_events = value & ((1 << EVENT_STATE_CHANGED) | (1 << EVENT_CLAIM_ATTEMPT));
+      return enabled_events;
+
+    default:
+      return NO_PARAMETER_VALUE;
+  }
+}
+
+/**
+ * Transmits the performance counters to the PC, and clears them.
+ *
+ * The response consists of a count of counters, followed by each of the
+ * counters' values as a word, in the order given in counters.h.
+ */
+void send_counters() {
+
+  uint16_t values[PERFORMANCE_COUNTER_COUNT];
+  uint8_t i;
+
+  read_and_clear_counters(values);
+
+  send_byte_to_pc(PERFORMANCE_COUNTER_COUNT);
+  for(i = 0; i < PERFORMANCE_COUNTER_COUNT; ++i) {
+    send_word_to_pc(values[i]);
+  }
+}
+
+/**
+ * Transmits the interrupt profiles to the PC, and clears them.
+ *
+ * The response consists of a count of profiles (zero, if the firmware was
+ * built without ISR_PROFILING), followed by each profile, in the order given
+ * in profiler.h: its call count, minimum and maximum duration as words, and
+ * its total duration as a long, all in CPU cycles.
+ */
+void send_isr_profiles() {
+
+  struct isr_profile profiles[PROFILED_ISR_COUNT];
+  uint8_t count, i;
+
+  count = read_and_clear_isr_profiles(profiles);
+
+  send_byte_to_pc(count);
+  for(i = 0; i < count; ++i) {
+    send_word_to_pc(profiles[i].calls);
+    send_word_to_pc(profiles[i].min_cycles);
+    send_word_to_pc(profiles[i].max_cycles);
+    send_long_to_pc(profiles[i].total_cycles);
+  }
+}
+
+/**
+ * Transmits the log of claim attempts to the PC, emptying it.
+ *
+ * The response consists of a count of events, a count of events which were
+ * lost because the log overflowed, and then each of the events, oldest first:
+ * a four-byte timestamp (in timer ticks), the received value, the event's
+ * flags, and the value's hamming distance from the expected response.
+ */
+void send_claim_history() {
+
+  struct claim_event events[CLAIM_LOG_SIZE];
+  uint8_t count, dropped, i;
+
+  //Take a copy of the log, so we're not holding off interrupts while we transmit.
+  count = drain_claim_log(events, CLAIM_LOG_SIZE, &dropped);
+
+  send_byte_to_pc(count);
+  send_byte_to_pc(dropped);
+
+  for(i = 0; i < count; ++i) {
+    send_long_to_pc(events[i].timestamp);
+    send_byte_to_pc(events[i].value);
+    send_byte_to_pc(events[i].flags);
+    send_byte_to_pc(events[i].distance);
+  }
+}
+
+/**
+ * Receives the host's position in the shared transmit frame, in milliseconds
+ * as a word, which follows the request; and aligns this beacon's frames with
+ * it. No response is sent, so the host can synchronize a whole field quickly.
+ */
+void receive_transmit_frame_sync() {
+
+  uint8_t position[2];
+  uint16_t milliseconds_into_frame;
+
+  if(receive_bytes_from_pc(position, sizeof(position))) {
+
+    //The host may count any number of whole frames; only its position in the
+    //current one matters. Reduce it while it's still in the host's units, so
+    //our rounding of the frame to whole ticks isn't multiplied with it.
+    milliseconds_into_frame = ((uint16_t)position[0] << 8) | position[1];
+    if(transmit_frame_milliseconds) {
+      milliseconds_into_frame %= transmit_frame_milliseconds;
+    }
+
+    ir_synchronize_transmit_frame((uint32_t)milliseconds_into_frame * TIMER_TICKS_PER_SECOND / 1000);
+  }
+}
+
+/**
+ * Receives a scheduled mode change from the PC, which follows the request:
+ * the new mode, as a byte, and the time at which it should take effect, as
+ * a long of milliseconds of our uptime (see REQUEST_TIME_SYNC). Responds with
+ * the board's state, as an acknowledgement; or with an invalid state, if the
+ * change couldn't be scheduled.
+ *
+ * This allows the PC to arm every beacon on the field ahead of time, so all
+ * of them change mode at the same instant, rather than one after another.
+ */
+void receive_scheduled_mode() {
+
+  uint8_t request[5];
+  bool scheduled = false;
+
+  if(receive_bytes_from_pc(request, sizeof(request))) {
+    scheduled = schedule_mode_change(request[0],
+        ((uint32_t)request[1] << 24) | ((uint32_t)request[2] << 16) | ((uint16_t)request[3] << 8) | request[4]);
+  }
+
+  send_state_to_pc(scheduled ? beacon : invalid_state);
+}
+
+/**
+ * Applies a scheduled mode change, once it's due; or, if it isn't yet,
+ * waits for it. Timer events can only be delayed by a limited number of
+ * ticks, so a distant change may take several waits. Called from within
+ * an interrupt.
+ */
+static void wait_for_scheduled_mode_change() {
+
+  int32_t remaining = scheduled_mode_due - timer_ticks();
+
+  if(remaining <= 0) {
+    scheduled_mode_event = NO_TIMER_EVENT;
+    post_work(apply_scheduled_mode_change, scheduled_mode);
+  } else {
+    scheduled_mode_event = schedule_timer_event(wait_for_scheduled_mode_change, (remaining > 0xFFFF) ? 0xFFFF : remaining);
+  }
+}
+
+/**
+ * Applies a scheduled mode change, keeping the rest of the beacon's state.
+ * Run from the main loop; see wait_for_scheduled_mode_change.
+ */
+void apply_scheduled_mode_change(uint16_t mode) {
+
+  BoardState new_state = beacon;
+
+  //If the change was cancelled after it came due, ignore it.
+  if(!mode_change_scheduled) {
+    return;
+  }
+
+  mode_change_scheduled = false;
+  new_state.mode = mode;
+  apply_state(new_state);
+}
+
+/**
+ * Schedules a change to the given mode, which will take effect once our
+ * uptime reaches the given number of milliseconds. The change is made to
+ * within a timer tick of the requested time. Returns false if the change
+ * couldn't be scheduled: if it's too far in the future, or if there are no
+ * timer events free.
+ */
+bool schedule_mode_change(uint8_t mode, uint32_t milliseconds) {
+
+  uint32_t now_milliseconds, delay;
+  uint16_t now_microseconds;
+  bool due_now = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    cancel_scheduled_mode_change();
+
+    //Read both clocks together, so we can convert from one to the other.
+    now_milliseconds = uptime_milliseconds(&now_microseconds);
+    scheduled_mode_due = timer_ticks();
+    delay = milliseconds - now_milliseconds;
+
+    //Times which have already passed wrap around to large delays;
+    //apply those immediately, but refuse times too far in the future.
+    if((int32_t)delay < 0) {
+      due_now = true;
+    } else if(delay > MAXIMUM_MODE_CHANGE_DELAY) {
+      return false;
+    }
+
+    //Otherwise, find the tick nearest to the requested time.
+    delay = delay * 1000;
+    if(delay <= now_microseconds) {
+      due_now = true;
+    } else {
+      scheduled_mode_due += (delay - now_microseconds + MICROSECONDS_PER_TICK / 2) / MICROSECONDS_PER_TICK;
+    }
+
+    scheduled_mode = mode;
+    mode_change_scheduled = true;
+
+    //... and wait for it.
+    if(!due_now) {
+      wait_for_scheduled_mode_change();
+
+      if(scheduled_mode_event == NO_TIMER_EVENT) {
+        mode_change_scheduled = false;
+        return false;
+      }
+    }
+  }
+
+  if(due_now) {
+    apply_scheduled_mode_change(mode);
+  }
+
+  return true;
+}
+
+/**
+ * Cancels any scheduled mode change.
+ */
+void cancel_scheduled_mode_change() {
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    cancel_timer_event(scheduled_mode_event);
+    scheduled_mode_event = NO_TIMER_EVENT;
+    mode_change_scheduled = false;
+  }
+}
+
+/**
+ * Transmits the delay between the beacon's most recent start of claim code
+ * transmission and its first claim code to the PC, in microseconds, as a
+ * long; or all ones, if no code has been sent since.
+ */
+void send_transmit_latency() {
+
+  uint32_t latency = ir_first_transmit_latency();
+
+  if(latency != NO_TRANSMIT_LATENCY) {
+    latency *= 1000000UL / TIMER_TICKS_PER_SECOND;
+  }
+
+  send_long_to_pc(latency);
+}
+
 /**
  * Applies the provided "beacon state" object to the
  * board, replacing the current state, and updating all peripherals.
  */
 void apply_state(BoardState new_state) {
 
+  bool changed = (new_state.raw_data != beacon.raw_data);
+
   //Apply the new state itself...
   beacon = new_state;
+  TRACE(TRACE_STATE_CHANGE, beacon.raw_data);
 
-  //Seed the internal random number generator using
-  //the current value of Timer 1 (which is run by the light
-  //module). This allows us to use the PC communications erratic
-  //timings as a source of pseudo-randomness.
-  srand(TCNT1);
+  //... let the PC know, if it's asked to be told...
+  if(changed && (enabled_events & (1 << EVENT_STATE_CHANGED))) {
+    send_event_to_pc(EVENT_STATE_CHANGED, &new_state.raw_data, 1);
+  }
 
   //And apply the state's effects.
   enforce_state();
@@ -279,6 +874,8 @@ void enforce_state() {
   // If the beacon has an invalid ID, turn off all peripherals
   // and wait to be assigned an ID.
   if(beacon_is_disabled()) {
+    set_light_effect(LightEffectNone);
+    stop_transmitting_claim_code();
     return;
   }
 
@@ -301,28 +898,60 @@ void enforce_state() {
   }
 
   // If the beacon can be claimed, ensure the beacon's lights
-  // is running at full brightness, and the IR channel is on.
+  // are "breathing" at full brightness, and the IR channel is on.
   // Otherwise, dim the light so it's a less attractive target,
   // and disable IR transmission.
   if(beacon_can_be_claimed()) {
     set_light_brightness(Bright);
+    set_light_effect(LightEffectBreathing);
     start_transmitting_claim_code();
     ir_enable_receive();
   } else {
     set_light_brightness(Dim);
-    ir_stop_transmitting();
+    set_light_effect(LightEffectNone);
+    stop_transmitting_claim_code();
     ir_disable_receive();
   }
+
+  // While counting down to the start of a round, pulse the lights
+  // once per second, so the field crew can see the round is about to start.
+  if(beacon.mode == MODE_COUNTDOWN) {
+    set_light_effect(LightEffectCountdown);
+  }
 }
 
 /**
  * Starts the repeated transmission of a "claim code", a code which is
  * transmitted to the competing robots. If a robot is able to respond
  * with a modification of this code, it can claim the beacon.
+ * Has no effect if claim codes are already being transmitted.
  */
 void start_transmitting_claim_code() {
-  claim_code = rand();
-  ir_start_continuously_transmitting(claim_code);
+
+  //If we're already transmitting, the robots may be responding to the
+  //codes we've sent; leave them valid.
+  if(transmitting_claim_codes) {
+    return;
+  }
+
+  transmitting_claim_codes = true;
+
+  //Codes from any previous round are no longer valid; and each round
+  //starts with a full allowance of claim attempts. The window stays
+  //empty until value_to_transmit draws (and records) the first code
+  //that's actually sent.
+  clear_claim_window();
+  refill_claim_tokens();
+
+  ir_start_continuously_transmitting();
+}
+
+/**
+ * Stops the transmission of claim codes.
+ */
+void stop_transmitting_claim_code() {
+  transmitting_claim_codes = false;
+  ir_stop_transmitting();
 }
 
 /**
@@ -335,8 +964,9 @@ bool beacon_can_be_claimed() {
   //Determine if the beacon is already claimed...
   uint8_t beacon_already_owned = ((uint8_t)beacon.owner == (uint8_t)beacon.affiliation);
 
-  //.. and determine if the beacon is "frozen", and thus unable to be claimed.
-  uint8_t beacon_is_frozen = (beacon.mode == MODE_FROZEN);
+  //.. and determine if the beacon is "frozen", or waiting for the round
+  //to start, and thus unable to be claimed.
+  uint8_t beacon_is_frozen = (beacon.mode == MODE_FROZEN) || (beacon.mode == MODE_COUNTDOWN);
 
   //The beacon should be claimable if it's _not_ owned by the affiliated team,
   //and isn't in the frozen state.
@@ -354,67 +984,116 @@ bool beacon_is_disabled() {
 
 
 /**
- * Returns the hamming distance (number of bit errors)
- * between two given bytes.
- */
-uint8_t hamming_distance(uint8_t a, uint8_t b) {
-
-  unsigned char distance = 0;
+ * Functions which determines the value that should be transmitted
+ * over IR. This is called roughly once per second by the IR module,
+ * from within an interrupt.
+ */ 
+uint8_t value_to_transmit() {
 
-  //For each of the bits in an eight-bit number...
-  for(uint16_t i = 1; i < 0x100; i = i << 1) {
+  //Generate a new psuedo-random claim code; this is cheap enough
+  //to do from within the interrupt...
+  claim_code = random_byte();
+  record_claim_code(claim_code);
+  TRACE(TRACE_IR_TRANSMIT, claim_code);
 
-      //If the given bit is different for both A and B,
-      //increase the hamming distance.
-      if((a & i) != (b & i)) {
-        ++distance; 
-      }
-  }
+  //... and transmit that value.
+  return claim_code;
 
-  //... return the computed hamming distance.
-  return distance;
 }
 
 
 /**
- * Returns true iff the provided "response code"
- * matches the transmitted "claim code". If this is
- *
+ * Function which handles the receipt of an IR value from
+ * the competing robot. This function is called from within
+ * an interrupt, and thus is assumed to be uninterruptable;
+ * accordingly, it defers the actual processing of the
+ * claim attempt to the main loop.
  */
-bool is_valid_response_code(uint8_t code) {
+void handle_IR_receive(uint8_t value) {
+
+  //If the beacon's in play, and the robots have been making attempts too
+  //quickly, throttle this one: record it, but don't judge it.
+  if(!beacon_is_disabled() && !take_claim_token()) {
+    TRACE(TRACE_CLAIM_THROTTLED, value);
+    log_claim_event(value, CLAIM_EVENT_THROTTLED, NO_CLAIM_CODE_DISTANCE);
+    count_event(COUNTER_THROTTLED_CLAIMS);
+    return;
+  }
+
+  //Judge the attempt against the claim codes that were valid when the
+  //response arrived, so a new code being transmitted before the main loop
+  //gets to it can't invalidate it. This is only a few table lookups, so
+  //it's cheap enough to do here.
+  uint8_t distance = claim_response_distance(value);
+  bool accepted = distance <= maximum_allowed_errors;
+  uint32_t arrival_time = timer_ticks();
+
+  //The exact moment a robot's response arrives is a good source of entropy.
+  add_entropy(TCNT1 ^ TCNT3);
+  TRACE2(TRACE_IR_RECEIVE, value, distance);
+
+  //If the beacon's in play, leave the final verdict (and the record of it)
+  //to the main loop, which knows whether the beacon can still be claimed.
+  if(!beacon_is_disabled()) {
+    uint8_t saturated_distance = distance;
+
+    if(saturated_distance > CLAIM_ATTEMPT_DISTANCE_MASK) {
+      saturated_distance = CLAIM_ATTEMPT_DISTANCE_MASK;
+    }
+
+    if(post_work(process_claim_attempt, (accepted ? CLAIM_ATTEMPT_ACCEPTED : 0)
+          | ((uint16_t)saturated_distance << CLAIM_ATTEMPT_DISTANCE_SHIFT) | value)) {
+      uint8_t tail = (claim_arrivals_head + claim_arrivals_count) & (WORK_QUEUE_SIZE - 1);
+      claim_arrival_times[tail] = arrival_time;
+      ++claim_arrivals_count;
+      return;
+    }
+  }
 
-  //In this case, the cast is necessary, as avr-gcc
-  //will promote claim_code to an integer _before_ its bitwise
-  //not operation. We need it to be a uint8_t afterwards, so
-  //the comparison is performed correctly!
-  return hamming_distance(code, (uint8_t)~claim_code) <= maximum_allowed_errors;
+  //Otherwise, the attempt can't claim the beacon; record it as rejected.
+  log_claim_event_at(arrival_time, value, 0, distance);
+  count_event(COUNTER_REJECTED_CLAIMS);
 
 }
 
 
 /**
- * Functions which determines the value that should be transmitted
- * over IR. This is called roughly once per second by the IR module.
- */ 
-uint8_t value_to_transmit() {
+ * Processes an attempt to claim the beacon, which was received over IR.
+ * Run from the main loop; see handle_IR_receive.
+ *
+ * attempt: The received value, its distance, and whether it was judged
+ *    to be a valid response; see CLAIM_ATTEMPT_ACCEPTED.
+ */
+void process_claim_attempt(uint16_t attempt) {
 
-  //Determine a new, psuedo-random value to transmit.
-  claim_code = rand();
+  BoardState new_state = beacon;
+  uint8_t value = attempt & 0xFF;
+  uint8_t distance = (attempt >> CLAIM_ATTEMPT_DISTANCE_SHIFT) & CLAIM_ATTEMPT_DISTANCE_MASK;
+  bool accepted = (attempt & CLAIM_ATTEMPT_ACCEPTED) != 0;
+  uint32_t arrival_time;
 
-  //And transmit that value.
-  return claim_code;
+  if(distance == CLAIM_ATTEMPT_DISTANCE_MASK) {
+    distance = NO_CLAIM_CODE_DISTANCE;
+  }
 
-}
+  //Claim attempts are posted (and so run) in the order they arrived.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    arrival_time = claim_arrival_times[claim_arrivals_head];
+    claim_arrivals_head = (claim_arrivals_head + 1) & (WORK_QUEUE_SIZE - 1);
+    --claim_arrivals_count;
+  }
 
+  //If the beacon has since been disabled, or frozen (e.g. at the end of a
+  //round), an attempt which arrived in the meantime can no longer claim it.
+  if(beacon_is_disabled() || !beacon_can_be_claimed()) {
+    accepted = false;
+  }
 
-/**
- * Function which handles the receipt of an IR value from
- * the competing robot. This function is called from within
- * an interrupt, and thus is assumed to be uninterruptable.
- */
-void handle_IR_receive(uint8_t value) {
+  //Record the attempt, with the verdict we've actually reached.
+  log_claim_event_at(arrival_time, value, accepted ? CLAIM_EVENT_ACCEPTED : 0, distance);
+  count_event(accepted ? COUNTER_VALID_CLAIMS : COUNTER_REJECTED_CLAIMS);
 
-  //If the beacon is disabled, ignore all received IR data.
+  //If the beacon has been disabled, it no longer reacts to attempts at all.
   if(beacon_is_disabled()) {
     return;
   }
@@ -424,18 +1103,30 @@ void handle_IR_receive(uint8_t value) {
 
   //If we've recieved a valid response code,
   //change this becaon's owner to match the claiming robot.
-  if(is_valid_response_code(value)) {
-    beacon.owner = beacon.affiliation;
-  } 
-  //Otherwise, disable the receiver until after the next
-  //transmission is complete. This prevents contestants
-  //from "spamming" the robot.
-  else {
-    ir_disable_receive_until_transmit_complete();
+  if(accepted) {
+    new_state.owner = new_state.affiliation;
+    flash_light_effect(LightEffectClaimFlash);
+    TRACE2(TRACE_CLAIM_ACCEPTED, value, new_state.owner);
+  } else {
+    TRACE(TRACE_CLAIM_REJECTED, value);
+  }
+
+  //If the PC has asked to be told of claim attempts, tell it of this one,
+  //exactly as it appears in the claim history (see send_claim_history).
+  if(enabled_events & (1 << EVENT_CLAIM_ATTEMPT)) {
+    uint8_t event[] = {
+      arrival_time >> 24, arrival_time >> 16, arrival_time >> 8, arrival_time,
+      value,
+      accepted ? CLAIM_EVENT_ACCEPTED : 0,
+      distance
+    };
+    send_event_to_pc(EVENT_CLAIM_ATTEMPT, event, sizeof(event));
   }
 
-  //Apply the beacon's state.
-  apply_state(beacon);
+  //Apply the beacon's state, which tells the PC of any change of owner.
+  //Note that "spamming" the beacon with attempts is prevented by the rate
+  //limit in handle_IR_receive.
+  apply_state(new_state);
 
 }
 
@@ -445,4 +1136,6 @@ void handle_IR_receive(uint8_t value) {
  */ 
 void handle_IR_frame_error(uint8_t value) {
   last_claim_attempt = misframed_claim_code;
+  TRACE(TRACE_IR_FRAMING_ERROR, value);
+  log_claim_event(value, CLAIM_EVENT_FRAMING_ERROR, claim_response_distance(value));
 }
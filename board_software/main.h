@@ -75,10 +75,21 @@ void apply_state(BoardState new_state);
 void enforce_state();
 
 /**
- * Handles all requests (and commands) recieved from the PC.
+ * Sleeps until a request from the PC has been received, or an interrupt
+ * handler has deferred work to the main loop.
+ */
+void wait_for_work();
+
+/**
+ * Handles the requests (and commands) which the PC has already sent, as a batch.
  */
 void handle_pc_comm();
 
+/**
+ * Handles a single request (or command) from the PC.
+ */
+void handle_pc_request();
+
 /**
  * Returns true iff this beacon can be claimed;
  * that is, if it isn't owned by the current team.
@@ -115,13 +126,92 @@ void pull_up_unused_pins();
 void send_most_recent_claim_attempt();
 
 
+/**
+ * Transmits a snapshot of the beacon's status to the PC: its state, claim
+ * code, most recent claim attempt, and performance counters. This
+ * invalidates any existing claim attempt.
+ */
+void send_snapshot();
+
+/**
+ * Receives a parameter adjustment from the PC, applies it,
+ * and responds with the value that was applied.
+ */
+void receive_parameter();
+
+/**
+ * Sets one of the beacon's parameters, returning the value that was
+ * actually applied, or NO_PARAMETER_VALUE if the parameter is unknown.
+ */
+uint16_t set_parameter(uint8_t parameter, uint16_t value);
+
+/**
+ * Transmits the performance counters to the PC, and clears them.
+ */
+void send_counters();
+
+/**
+ * Transmits the interrupt profiles to the PC, and clears them.
+ */
+void send_isr_profiles();
+
+/**
+ * Transmits the log of claim attempts to the PC, emptying it.
+ */
+void send_claim_history();
+
+/**
+ * Receives the host's position in the shared transmit frame,
+ * and aligns this beacon's frames with it.
+ */
+void receive_transmit_frame_sync();
+
+/**
+ * Receives a mode change from the PC which is to take effect at a given
+ * time on our clock, and schedules it.
+ */
+void receive_scheduled_mode();
+
+/**
+ * Schedules a change to the given mode, which will take effect once our
+ * uptime (see uptime_milliseconds) reaches the given number of milliseconds;
+ * or immediately, if that time has already passed. Replaces any change
+ * which was already scheduled. Returns false if the change couldn't be
+ * scheduled.
+ */
+bool schedule_mode_change(uint8_t mode, uint32_t milliseconds);
+
+/**
+ * Applies a scheduled mode change, once it's due.
+ * Run from the main loop; see schedule_mode_change.
+ */
+void apply_scheduled_mode_change(uint16_t mode);
+
+/**
+ * Cancels any scheduled mode change.
+ */
+void cancel_scheduled_mode_change();
+
+/**
+ * Transmits the delay before the first claim code of the current round
+ * to the PC.
+ */
+void send_transmit_latency();
+
+
 /**
  * Starts the repeated transmission of a "claim code", a code which is
  * transmitted to the competing robots. If a robot is able to respond
  * with a modification of this code, it can claim the beacon.
+ * Has no effect if claim codes are already being transmitted.
  */ 
 void start_transmitting_claim_code();
 
+/**
+ * Stops the transmission of claim codes.
+ */
+void stop_transmitting_claim_code();
+
 
 /**
  * Function which handles the receipt of an IR value from
@@ -130,6 +220,12 @@ void start_transmitting_claim_code();
  */ 
 void handle_IR_receive(uint8_t value);
 
+/**
+ * Processes an attempt to claim the beacon, which was received over IR.
+ * Run from the main loop; see handle_IR_receive.
+ */
+void process_claim_attempt(uint16_t attempt);
+
 
 /**
  * Functions which determines the value that should be transmitted
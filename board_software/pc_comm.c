@@ -25,8 +25,34 @@
 * THE SOFTWARE.
 */
 
+#include <avr/sleep.h>
+
 #include "usb_serial/usb_serial.h"
 #include "pc_comm.h"
+#include "counters.h"
+
+/**
+ * The response to the current request, which is held back until it's
+ * complete, so it can be queued as a whole; see begin_pc_response. The
+ * buffer leaves room for the tag and length which frame a tagged response.
+ */
+#define TAGGED_FRAME_HEADER_SIZE 2
+static uint8_t response_frame[TAGGED_FRAME_HEADER_SIZE + PC_RESPONSE_SIZE];
+static uint8_t response_length;
+static bool holding_response = false;
+
+/**
+ * True iff the held response has outgrown its buffer; it's then dropped
+ * as a whole when it ends, like a response the queue couldn't hold.
+ */
+static bool response_overflowed = false;
+
+/**
+ * True iff we're sending a batch of responses, and iff one of them
+ * has asked for the output to be flushed; see begin_pc_response_batch.
+ */
+static bool batching_responses = false;
+static bool flush_deferred = false;
 
 
 /**
@@ -36,7 +62,7 @@
  * @param uint16_t The byte to be transmitted.
  */
 void send_byte_to_pc(uint8_t byte) {
-  usb_serial_putchar(byte);
+  send_bytes_to_pc(&byte, 1);
 }
 
 /**
@@ -45,8 +71,181 @@ void send_byte_to_pc(uint8_t byte) {
  * @param uint16_t The word to be transmitted.
  */
 void send_word_to_pc(uint16_t word) {
-  usb_serial_putchar(word >> 8);
-  usb_serial_putchar(word & 0xFF);
+  send_byte_to_pc(word >> 8);
+  send_byte_to_pc(word & 0xFF);
+}
+
+/**
+ * Transmits the provided long word to the PC, most significant byte first.
+ *
+ * @param uint32_t The long word to be transmitted.
+ */
+void send_long_to_pc(uint32_t word) {
+  send_word_to_pc(word >> 16);
+  send_word_to_pc(word & 0xFFFF);
+}
+
+/**
+ * Queues the given buffer, to be sent to the PC from the USB start-of-frame
+ * interrupt; this never waits. If the PC isn't reading our data quickly
+ * enough, and the queue can't hold the whole buffer, none of it is queued;
+ * this is counted.
+ */
+static void queue_for_pc(const uint8_t *buffer, uint8_t count) {
+  if(usb_serial_queue(buffer, count) < 0) {
+    count_event(COUNTER_USB_OVERFLOWS);
+  }
+}
+
+/**
+ * Transmits the given buffer to the PC, as a single write.
+ */
+void send_bytes_to_pc(const uint8_t *buffer, uint8_t count) {
+
+  //If we're holding back the response to a request, add to it; unless it
+  //won't fit, in which case the whole response will be dropped.
+  if(holding_response) {
+    if(count > PC_RESPONSE_SIZE - response_length) {
+      response_overflowed = true;
+      return;
+    }
+
+    while(count--) {
+      response_frame[TAGGED_FRAME_HEADER_SIZE + response_length++] = *buffer++;
+    }
+    return;
+  }
+
+  queue_for_pc(buffer, count);
+}
+
+/**
+ * Immediately transmits any data which is waiting to be sent to the PC,
+ * rather than waiting for the USB transmit timeout.
+ */
+void flush_pc_output() {
+
+  //If we're in the middle of a batch, wait until it's complete.
+  if(batching_responses) {
+    flush_deferred = true;
+    return;
+  }
+
+  usb_serial_release();
+}
+
+/**
+ * Starts a batch of responses, deferring any flushes until it ends.
+ */
+void begin_pc_response_batch() {
+  batching_responses = true;
+  flush_deferred = false;
+}
+
+/**
+ * Ends a batch of responses, flushing the output once if requested.
+ */
+void end_pc_response_batch() {
+
+  batching_responses = false;
+
+  if(flush_deferred) {
+    flush_pc_output();
+  }
+}
+
+/**
+ * Starts the response to a request, holding it back until it's complete.
+ */
+void begin_pc_response() {
+  holding_response = true;
+  response_overflowed = false;
+  response_length = 0;
+}
+
+/**
+ * Sends the held response to a request, and releases it to the PC. The
+ * response is queued as a whole, so it's either sent completely, or not at
+ * all; the PC never receives part of one.
+ */
+void end_pc_response() {
+
+  if(holding_response) {
+    holding_response = false;
+
+    if(response_overflowed) {
+      count_event(COUNTER_USB_OVERFLOWS);
+    } else if(response_length) {
+      queue_for_pc(response_frame + TAGGED_FRAME_HEADER_SIZE, response_length);
+    }
+  }
+
+  flush_pc_output();
+}
+
+/**
+ * Sends the held response to a tagged request: its tag, its length,
+ * and then the response itself; and releases it to the PC. Like any
+ * other response, the frame is sent completely, or not at all.
+ */
+void end_tagged_response(uint8_t tag) {
+
+  holding_response = false;
+
+  if(response_overflowed) {
+    count_event(COUNTER_USB_OVERFLOWS);
+  } else {
+    response_frame[0] = tag;
+    response_frame[1] = response_length;
+    queue_for_pc(response_frame, TAGGED_FRAME_HEADER_SIZE + response_length);
+  }
+
+  flush_pc_output();
+}
+
+/**
+ * Pushes an event to the PC: EVENT_TAG, the frame's length, the event's type,
+ * and its payload. The frame is queued as a whole, bypassing any held
+ * response, and released to the PC immediately (or at the end of the batch).
+ */
+void send_event_to_pc(uint8_t type, const uint8_t *payload, uint8_t length) {
+
+  uint8_t frame[TAGGED_FRAME_HEADER_SIZE + 1 + PC_EVENT_PAYLOAD_SIZE];
+  uint8_t i;
+
+  if(length > PC_EVENT_PAYLOAD_SIZE) {
+    length = PC_EVENT_PAYLOAD_SIZE;
+  }
+
+  frame[0] = EVENT_TAG;
+  frame[1] = length + 1;
+  frame[2] = type;
+  for(i = 0; i < length; ++i) {
+    frame[TAGGED_FRAME_HEADER_SIZE + 1 + i] = payload[i];
+  }
+
+  //As with any other data, drop the event if the PC isn't keeping up.
+  queue_for_pc(frame, TAGGED_FRAME_HEADER_SIZE + 1 + length);
+  flush_pc_output();
+}
+
+/**
+ * Responds to a time synchronization request, which was received at the
+ * given uptime, with the time of its receipt and of our response.
+ */
+void send_time_sync_to_pc(uint32_t received_milliseconds, uint16_t received_microseconds) {
+
+  uint32_t milliseconds;
+  uint16_t microseconds;
+
+  send_long_to_pc(received_milliseconds);
+  send_word_to_pc(received_microseconds);
+
+  //Read the clock as late as possible, so the response is stamped
+  //as close as we can get to its actual transmission.
+  milliseconds = uptime_milliseconds(&microseconds);
+  send_long_to_pc(milliseconds);
+  send_word_to_pc(microseconds);
 }
 
 /**
@@ -55,7 +254,7 @@ void send_word_to_pc(uint16_t word) {
 * state: The current state to be transmitted.
 */
 void send_state_to_pc(BoardState state) {
-  usb_serial_putchar(state.raw_data);
+  send_byte_to_pc(state.raw_data);
 }
 
 /**
@@ -70,4 +269,29 @@ BoardState receive_state_from_pc() {
 
 }
 
+/**
+ * Receives the given number of bytes from the PC, waiting (up to
+ * PC_RECEIVE_TIMEOUT) for each to arrive. Returns true iff all of the
+ * bytes were received.
+ */
+bool receive_bytes_from_pc(uint8_t *buffer, uint8_t count) {
+
+  uint32_t started;
+
+  while(count--) {
+
+    //Wait for the next byte, sleeping between interrupts; the timer tick
+    //ensures we wake regularly enough to notice the timeout.
+    started = timer_ticks();
+    while(!usb_serial_available()) {
+      if(timer_ticks() - started > PC_RECEIVE_TIMEOUT) {
+        return false;
+      }
+      sleep_mode();
+    }
 
+    *buffer++ = usb_serial_getchar();
+  }
+
+  return true;
+}
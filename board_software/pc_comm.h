@@ -28,7 +28,10 @@
 #ifndef __PC_COMM_H__
 #define __PC_COMM_H__
 
+#include <stdbool.h>
+
 #include "state.h"
+#include "timers.h"
 
 /**
  *
@@ -45,6 +48,114 @@ void send_byte_to_pc(uint8_t byte);
  */
 void send_word_to_pc(uint16_t word);
 
+/**
+ * Transmits the provided long word to the PC, most significant byte first.
+ *
+ * @param uint32_t The long word to be transmitted.
+ */
+void send_long_to_pc(uint32_t word);
+
+/**
+ * Transmits the given buffer to the PC, without waiting: the data is queued,
+ * and sent from the USB start-of-frame interrupt. If the PC isn't keeping
+ * up, and the queue can't hold the whole buffer, none of it is sent; this
+ * is counted as a USB overflow (see counters.h). While a response is being
+ * held (see begin_pc_response), the data is added to it instead.
+ *
+ * @param buffer The bytes to be transmitted.
+ * @param count The number of bytes to be transmitted.
+ */
+void send_bytes_to_pc(const uint8_t *buffer, uint8_t count);
+
+/**
+ * Immediately transmits any data which is waiting to be sent to the PC,
+ * rather than waiting for the USB transmit timeout.
+ */
+void flush_pc_output();
+
+/**
+ * The largest response which can be sent to a request, in bytes. A larger
+ * response is dropped as a whole, and counted as a USB overflow.
+ */
+#define PC_RESPONSE_SIZE 128
+
+/**
+ * Starts the response to a request from the PC: until the response is ended,
+ * any data sent to the PC is held back, so the response can be queued as a
+ * whole. Otherwise, if the queue filled partway through, the PC could receive
+ * only part of a response, and lose its place in the protocol.
+ */
+void begin_pc_response();
+
+/**
+ * Marks the end of a complete response to a request from the PC, and queues
+ * it. The USB controller only sends a partial packet once it's released, or
+ * after a flush timeout of several milliseconds; so the response is released
+ * to the PC immediately, or, within a batch of responses, as soon as the
+ * batch ends.
+ *
+ * Every request's response should be ended this way (or by
+ * end_tagged_response); handle_pc_request does so once the request's
+ * handler returns.
+ */
+void end_pc_response();
+
+/**
+ * Starts a batch of responses: until the batch ends, requests to flush the
+ * output are deferred, so the responses are packed into as few USB packets
+ * as possible.
+ */
+void begin_pc_response_batch();
+
+/**
+ * Ends a batch of responses, flushing the output once if any of the
+ * responses requested it.
+ */
+void end_pc_response_batch();
+
+/**
+ * Ends the held response to a tagged request, framing it with the request's
+ * tag and the response's length, so the PC can match it to its request.
+ *
+ * @param tag The tag that the PC gave the request.
+ */
+void end_tagged_response(uint8_t tag);
+
+/**
+ * The tag which marks an event: a frame which the beacon sends to the PC
+ * unprompted (see send_event_to_pc). The PC must not use it for requests.
+ */
+#define EVENT_TAG 0xFF
+
+/**
+ * The largest payload an event can carry, in bytes.
+ */
+#define PC_EVENT_PAYLOAD_SIZE 8
+
+/**
+ * Pushes an event to the PC without waiting to be asked. The event is framed
+ * like the response to a tagged request, with EVENT_TAG in place of a tag:
+ * then its length, its type (one of the EVENT_ constants in state.h), and its
+ * payload. It's sent as soon as possible, even while a response is being
+ * held. The PC can't tell an event from the start of an untagged response,
+ * so it should only enable events if it tags every request.
+ *
+ * @param type The type of the event.
+ * @param payload The event's content.
+ * @param length The length of the event's content, up to PC_EVENT_PAYLOAD_SIZE.
+ */
+void send_event_to_pc(uint8_t type, const uint8_t *payload, uint8_t length);
+
+/**
+ * Responds to a time synchronization request, which the board received at
+ * the given uptime (see uptime_milliseconds): sends the time at which the
+ * request arrived, then the time at which the response is sent, each as a
+ * long of milliseconds followed by a word of microseconds. Like an NTP
+ * exchange, this lets the PC estimate the offset between its clock and ours,
+ * while discounting the time we took to respond.
+ */
+void send_time_sync_to_pc(uint32_t received_milliseconds, uint16_t received_microseconds);
+
 /** 
  * Generic invalid state constant.
  */ 
@@ -63,5 +174,17 @@ void send_state_to_pc(BoardState state);
  */ 
 BoardState receive_state_from_pc();
 
+/**
+ * The longest we'll wait for the rest of a multi-byte request, in timer ticks.
+ */
+#define PC_RECEIVE_TIMEOUT (TIMER_TICKS_PER_SECOND / 10)
+
+/**
+ * Receives the given number of bytes from the PC, e.g. the arguments of a
+ * request, waiting (up to PC_RECEIVE_TIMEOUT) for each to arrive.
+ * Returns true iff all of the bytes were received.
+ */
+bool receive_bytes_from_pc(uint8_t *buffer, uint8_t count);
+
 
 #endif
@@ -0,0 +1,97 @@
+/**
+ * profiler.c
+ * Optional interrupt profiler for the JD Beacon Board, which measures how
+ * long each of the main interrupt handlers runs for. Only built in when
+ * ISR_PROFILING is defined (e.g. "make ISR_PROFILING=1").
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <util/atomic.h>
+
+#include "profiler.h"
+
+#ifdef ISR_PROFILING
+
+volatile struct isr_profile isr_profiles[PROFILED_ISR_COUNT];
+
+/**
+ * Empties a single profile, ready to accumulate new measurements.
+ */
+static inline void clear_isr_profile(volatile struct isr_profile *profile) {
+  profile->calls = 0;
+  profile->min_cycles = 0xFFFF;
+  profile->max_cycles = 0;
+  profile->total_cycles = 0;
+}
+
+/**
+ * Sets up the free-running timer used to time the interrupts.
+ */
+void set_up_isr_profiler() {
+
+  uint8_t i;
+
+  for(i = 0; i < PROFILED_ISR_COUNT; ++i) {
+    clear_isr_profile(&isr_profiles[i]);
+  }
+
+  //Run Timer4 in normal mode across its full ten-bit range (TOP is set
+  //by OCR4C, via the shared high byte), at a quarter of the CPU clock.
+  //Timer4 is otherwise unused, so it only ever counts.
+  TCCR4A = 0;
+  TCCR4C = 0;
+  TCCR4D = 0;
+  TC4H   = 0x03;
+  OCR4C  = 0xFF;
+  TC4H   = 0;
+  TCCR4B = (1 << CS41) | (1 << CS40);
+}
+
+/**
+ * Copies each of the profiles into the given buffer and clears them, atomically.
+ */
+uint8_t read_and_clear_isr_profiles(struct isr_profile *profiles) {
+
+  uint8_t i;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(i = 0; i < PROFILED_ISR_COUNT; ++i) {
+      profiles[i] = isr_profiles[i];
+      clear_isr_profile(&isr_profiles[i]);
+    }
+  }
+
+  return PROFILED_ISR_COUNT;
+}
+
+#else
+
+void set_up_isr_profiler() {}
+
+uint8_t read_and_clear_isr_profiles(struct isr_profile *profiles) {
+  return 0;
+}
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * profiler.h
+ * Optional interrupt profiler for the JD Beacon Board, which measures how
+ * long each of the main interrupt handlers runs for. Only built in when
+ * ISR_PROFILING is defined (e.g. "make ISR_PROFILING=1").
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <stdint.h>
+#include <avr/io.h>
+
+/**
+ * Each of the interrupts which can be profiled. The host PC receives the
+ * profiles in this order, so new interrupts should only be added at the end.
+ */
+enum profiled_isr {
+  PROFILE_TIMER_TICK = 0,
+  PROFILE_TIMER_DISPATCH,
+  PROFILE_IR_RECEIVE,
+  PROFILE_IR_TRANSMIT,
+  PROFILE_USB_GENERAL,
+  PROFILE_USB_ENDPOINT,
+  PROFILED_ISR_COUNT
+};
+
+/**
+ * The accumulated timing for a single interrupt, in CPU cycles.
+ */
+struct isr_profile {
+  uint16_t calls;
+  uint16_t min_cycles;
+  uint16_t max_cycles;
+  uint32_t total_cycles;
+};
+
+/**
+ * Sets up the free-running timer used to time the interrupts.
+ * Does nothing if profiling isn't built in.
+ */
+void set_up_isr_profiler();
+
+/**
+ * Copies each of the profiles into the given buffer (which must have room
+ * for PROFILED_ISR_COUNT entries) and clears them, atomically. Returns the
+ * number of profiles copied, which is zero if profiling isn't built in.
+ */
+uint8_t read_and_clear_isr_profiles(struct isr_profile *profiles);
+
+
+#ifdef ISR_PROFILING
+
+/**
+ * The profiling timer counts once every ISR_PROFILE_CYCLES_PER_COUNT cycles,
+ * and wraps after ISR_PROFILE_PERIOD counts; so durations are measured to
+ * the nearest four cycles, and can be measured up to 4095 cycles (256us).
+ * Longer durations are recorded as ISR_PROFILE_MAX_CYCLES, so a saturated
+ * maximum should be read as "at least this long".
+ */
+#define ISR_PROFILE_CYCLES_PER_COUNT 4
+#define ISR_PROFILE_PERIOD           0x400
+#define ISR_PROFILE_MAX_CYCLES       (ISR_PROFILE_PERIOD * ISR_PROFILE_CYCLES_PER_COUNT)
+
+extern volatile struct isr_profile isr_profiles[PROFILED_ISR_COUNT];
+
+/**
+ * The state of a single in-progress measurement.
+ */
+struct isr_profile_scope {
+  uint8_t isr;
+  uint16_t start;
+};
+
+/**
+ * Reads the profiling timer (Timer4, running at a quarter of the CPU clock).
+ * Timer4 is ten bits wide; its high bits are latched into TC4H when the
+ * low byte is read.
+ */
+static inline uint16_t isr_profile_timestamp() {
+  uint8_t low = TCNT4;
+  return ((uint16_t)TC4H << 8) | low;
+}
+
+/**
+ * Starts timing an interrupt. The overflow flag is cleared first, so if it's
+ * set by the end of the measurement, the timer has wrapped since our start.
+ */
+static inline struct isr_profile_scope begin_isr_profile(uint8_t isr) {
+  struct isr_profile_scope scope;
+
+  TIFR4 = (1 << TOV4);
+  scope.isr = isr;
+  scope.start = isr_profile_timestamp();
+
+  return scope;
+}
+
+/**
+ * Finishes timing an interrupt, and accumulates the result into its profile.
+ * Interrupts don't nest, so this needs no further protection.
+ */
+static inline void end_isr_profile(struct isr_profile_scope *scope) {
+
+  volatile struct isr_profile *profile = &isr_profiles[scope->isr];
+  uint16_t end = isr_profile_timestamp();
+  uint16_t cycles;
+
+  //If the timer hasn't overflowed, the interval is a simple difference.
+  //If it has, and we've ended "before" we started, it's wrapped once.
+  //Otherwise, we've run for at least a whole period; saturate.
+  if(!(TIFR4 & (1 << TOV4))) {
+    cycles = (end - scope->start) * ISR_PROFILE_CYCLES_PER_COUNT;
+  } else if(end < scope->start) {
+    cycles = (end + ISR_PROFILE_PERIOD - scope->start) * ISR_PROFILE_CYCLES_PER_COUNT;
+  } else {
+    cycles = ISR_PROFILE_MAX_CYCLES;
+  }
+
+  if(profile->calls != 0xFFFF) {
+    ++profile->calls;
+  }
+  if(cycles < profile->min_cycles) {
+    profile->min_cycles = cycles;
+  }
+  if(cycles > profile->max_cycles) {
+    profile->max_cycles = cycles;
+  }
+  profile->total_cycles += cycles;
+}
+
+/**
+ * Times the enclosing interrupt handler, from this point until it returns
+ * (by any path). Should be the first statement in the handler.
+ */
+#define PROFILE_ISR(isr) \
+  struct isr_profile_scope __isr_profile __attribute__((cleanup(end_isr_profile))) = begin_isr_profile(isr)
+
+#else
+
+#define PROFILE_ISR(isr)
+
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * random.c
+ * Fast pseudo-random number generation for the JD Beacon Board: a 16-bit
+ * xorshift generator, stirred with timing jitter harvested from IR and USB
+ * events.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "random.h"
+
+volatile uint8_t entropy_pool = 0;
+
+/**
+ * The generator's state. Xorshift generators must never reach a state of
+ * zero, from which they can't escape; see random_byte.
+ */
+static volatile uint16_t random_state = 0xACE1;
+
+
+/**
+ * Returns a pseudo-random byte, consuming any entropy which has been
+ * collected since the last call.
+ *
+ * This uses the (7, 9, 8) xorshift triple, which visits every non-zero
+ * 16-bit state; on the AVR, each of its shifts by eight or more is just
+ * a byte move, so a call costs a few dozen cycles.
+ */
+uint8_t random_byte() {
+
+  uint16_t state;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    //Stir in any collected entropy, which perturbs the sequence by an
+    //unpredictable amount; then ensure we haven't stirred our way to zero.
+    state = random_state ^ entropy_pool;
+    entropy_pool = 0;
+
+    if(!state) {
+      state = 0xACE1;
+    }
+
+    //Advance the generator...
+    state ^= state << 7;
+    state ^= state >> 9;
+    state ^= state << 8;
+
+    random_state = state;
+  }
+
+  //... and fold both halves of its state into the result. Folding alone
+  //leaves short runs of bytes more evenly spread than chance would; mixing
+  //the high half back in through a (single-instruction) multiply doesn't.
+  return (uint8_t)(((state >> 8) ^ (state & 0xFF)) * 0x9D) + (state >> 8);
+}
@@ -0,0 +1,60 @@
+/**
+ * random.h
+ * Fast pseudo-random number generation for the JD Beacon Board: a 16-bit
+ * xorshift generator, stirred with timing jitter harvested from IR and USB
+ * events.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __RANDOM_H__
+#define __RANDOM_H__
+
+#include <stdint.h>
+#include <util/atomic.h>
+
+/**
+ * The entropy pool, which collects jitter samples until the generator next
+ * runs. This should only be accessed via the functions below.
+ */
+extern volatile uint8_t entropy_pool;
+
+/**
+ * Stirs a single sample (e.g. the low byte of a free-running timer,
+ * captured when an external event occurs) into the entropy pool.
+ * Safe (and cheap) to call from interrupt context.
+ */
+static inline void add_entropy(uint8_t sample) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    entropy_pool = (uint8_t)((entropy_pool << 1) | (entropy_pool >> 7)) ^ sample;
+  }
+}
+
+/**
+ * Returns a pseudo-random byte, consuming any entropy which has been
+ * collected since the last call. Safe to call from interrupt context.
+ */
+uint8_t random_byte();
+
+#endif
@@ -32,13 +32,25 @@
 
 void set_up_hardware();
 void handle_IR_receive(uint8_t value);
+void handle_IR_frame_error(uint8_t value);
 
 /**
  * The relative brightnesses for a bright and dim beacon LED,
- * in terms of percent duty cycle.
+ * on a scale from 0 (off) to 255 (fully on).
  */
-static const uint8_t Bright = 100;
-static const uint8_t Dim = 5;
+static const uint8_t Bright = 255;
+static const uint8_t Dim = 13;
+
+/**
+ * The number of consecutive framing errors after which we assume the beacon
+ * under test has changed its signaling rate, and try the next rate.
+ */
+static const uint8_t framing_errors_before_rate_change = 2;
+
+/**
+ * The number of framing errors we've seen since we last received a valid byte.
+ */
+static volatile uint8_t consecutive_framing_errors = 0;
 
 
 /**
@@ -64,6 +76,10 @@ int main() {
   //In this case, receipt of any signals will trigger the "handle IR receive" function.
   register_receive_handler(handle_IR_receive);
 
+  //If the beacon switches to a signaling rate other than ours, we'll only
+  //see framing errors; use them to search for its new rate.
+  register_frame_error_handler(handle_IR_frame_error);
+
   //Wait forever, allowing the IR interrupts to occur
   //when appropriate.
   while(1);
@@ -161,6 +177,9 @@ void pull_up_unused_pins() {
  */
 void handle_IR_receive(uint8_t value) {
 
+  //We're receiving at the beacon's rate.
+  consecutive_framing_errors = 0;
+
   //If the "silent operation" flag wasn't defined
   //at compile time, indicate that the beacon has received IR.
   #ifndef SILENT_OPERATION
@@ -175,3 +194,18 @@ void handle_IR_receive(uint8_t value) {
 }
 
 
+
+/**
+ * Function which handles a framing error. A few in a row suggest that the
+ * beacon board under test is signaling at a different rate than we are, so
+ * we step through the supported rates until we find its rate again.
+ */
+void handle_IR_frame_error(uint8_t value) {
+
+  if(++consecutive_framing_errors < framing_errors_before_rate_change) {
+    return;
+  }
+
+  consecutive_framing_errors = 0;
+  ir_step_baud_rate();
+}
@@ -110,18 +110,52 @@ union board_state_union {
 //TODO: Potentially look into replacing these with static unsigneds?
 #define MODE_OFF         0
 #define MODE_NORMAL      1
+#define MODE_COUNTDOWN   2
 #define MODE_FROZEN      27
 #define MODE_ERROR       31
 
 
 #define REQUEST_OFF           0
 #define REQUEST_NORMAL        1
+#define REQUEST_COUNTDOWN     2
+#define REQUEST_TAGGED        17
+#define REQUEST_SNAPSHOT      18
+#define REQUEST_SCHEDULE_MODE 19
+#define REQUEST_TIME_SYNC     20
+#define REQUEST_SYNC_TRANSMIT_FRAME 21
+#define REQUEST_TRANSMIT_LATENCY 22
+#define REQUEST_SET_PARAMETER 23
+#define REQUEST_ISR_PROFILE   24
+#define REQUEST_COUNTERS      25
+#define REQUEST_CLAIM_HISTORY 26
 #define REQUEST_FROZEN        27
 #define REQUEST_CLAIM_CODE    28
 #define REQUEST_LAST_CLAIM    29 
 #define REQUEST_BOOTLOADER    30
 #define REQUEST_UPDATE        31
 
+//Parameters which the PC can set, using REQUEST_SET_PARAMETER.
+#define PARAMETER_MAXIMUM_ALLOWED_ERRORS 0
+#define PARAMETER_CLAIM_WINDOW_SIZE      1
+#define PARAMETER_CLAIM_GRACE_PERIOD     2
+#define PARAMETER_CLAIM_RATE             3
+#define PARAMETER_CLAIM_BURST            4
+#define PARAMETER_IR_BAUD_RATE           5
+#define PARAMETER_TRANSMIT_INTERVAL      6
+#define PARAMETER_TRANSMIT_BURST         7
+#define PARAMETER_TRANSMIT_JITTER        8
+#define PARAMETER_TRANSMIT_FRAME         9
+#define PARAMETER_TRANSMIT_SLOT          10
+#define PARAMETER_EVENTS                 11
+
+//Events which the beacon can push to the PC without being asked; the PC
+//selects them by setting PARAMETER_EVENTS to a mask of (1 << EVENT_...).
+#define EVENT_STATE_CHANGED 0
+#define EVENT_CLAIM_ATTEMPT 1
+
+//The response to an invalid parameter request.
+#define NO_PARAMETER_VALUE 0xFFFF
+
 typedef union board_state_union BoardState;
 
 #endif
@@ -0,0 +1,59 @@
+/**
+ * tick_handlers.h
+ * Compile-time table of the handlers which are driven directly by the
+ * timer interrupt. This table is shared by every program which links the
+ * timers module (main.elf and responder.elf).
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __TICK_HANDLERS_H__
+#define __TICK_HANDLERS_H__
+
+#include "timers.h"
+#include "lights.h"
+
+/**
+ * Handlers which are called on every timer tick, directly from the tick
+ * interrupt. These calls are direct (rather than through function pointers),
+ * so the compiler can inline them into the interrupt; accordingly, they must
+ * be short, and must not call any other functions.
+ *
+ * Each entry has the form HANDLER(function). There are currently no per-tick
+ * handlers: the lights are dimmed by hardware PWM (see lights.c).
+ */
+#define TIMER_TICK_HANDLERS(HANDLER)
+
+/**
+ * Handlers which are called once every given number of ticks. Their countdowns
+ * are kept in the tick interrupt, but the handlers themselves are called from
+ * the lower-priority dispatch interrupt, so they're free to call other functions.
+ *
+ * Each entry has the form HANDLER(function, period_in_ticks). At most eight
+ * periodic handlers may be defined.
+ */
+#define TIMER_PERIODIC_HANDLERS(HANDLER) \
+  HANDLER(advance_light_effects, TIMER_TICKS_PER_SECOND / LIGHT_EFFECT_FRAME_RATE)
+
+#endif
@@ -27,18 +27,109 @@
  * THE SOFTWARE.
  */
 
+#include <util/atomic.h>
+
 #include "timers.h"
+#include "tick_handlers.h"
+#include "profiler.h"
+
+/**
+ * The number of "buckets" in the timer wheel. Each tick, the wheel advances
+ * by one bucket, and only the events in that bucket need to be examined.
+ * This must be a power of two, so the wheel can wrap without division.
+ */
+#define TIMER_WHEEL_BITS 5
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+
+/**
+ * Special bucket values, which indicate that an event isn't currently
+ * in the wheel: either because its slot is free, or because it's
+ * currently being dispatched.
+ */
+#define BUCKET_UNUSED    0xFF
+#define BUCKET_EXPIRING  0xFE
+
+/**
+ * Data structure which represents a single scheduled timer event.
+ */
+struct timer_event {
+
+  // The function to be called when the event occurs,
+  // or null if the event has been cancelled.
+  TimerEventHandler handler;
+
+  // The number of ticks between repetitions of this event,
+  // or zero for an event which should only occur once.
+  uint16_t period;
+
+  // The number of times the wheel must pass this event's bucket
+  // before the event occurs. This counts down, avoiding any division.
+  uint16_t rounds;
+
+  // The bucket in which this event currently resides.
+  uint8_t bucket;
+
+  // The index of the next event in the same bucket, or NO_TIMER_EVENT.
+  uint8_t next;
+
+};
+
+/**
+ * Storage for each of the schedulable timer events.
+ */
+static volatile struct timer_event timer_events[MAXIMUM_TIMER_EVENTS];
+
+/**
+ * The timer wheel itself. Each bucket holds the index of the first event
+ * in a linked list of events, or NO_TIMER_EVENT if the bucket is empty.
+ */
+static volatile uint8_t timer_wheel[TIMER_WHEEL_SIZE];
+
+/**
+ * The bucket which the tick interrupt most recently advanced to, and the
+ * bucket which the dispatch interrupt most recently processed. These only
+ * differ while dispatch is pending.
+ */
+static volatile uint8_t current_bucket = 0;
+static volatile uint8_t dispatched_bucket = 0;
+
+/**
+ * The number of ticks which have elapsed since the timers were set up.
+ * This wraps roughly every 76 hours.
+ */
+static volatile uint32_t elapsed_ticks = 0;
 
-// Declare each of the "tick handlers", which point to functions
-// which will execute at predefined intervals (150Hz and 1Hz).
-TimerEventHandler fast_tick_handler  = 0;
-TimerEventHandler slow_tick_handler  = 0;
+/**
+ * The number of whole milliseconds which have elapsed since the timers were
+ * set up, and the time since the last whole millisecond, in thousandths of
+ * a tick. A tick isn't a whole number of milliseconds, so the remainder is
+ * carried from tick to tick, and the clock never accumulates any error.
+ */
+static volatile uint32_t elapsed_milliseconds = 0;
+static volatile uint16_t millisecond_remainder = 0;
+
+/**
+ * Create an index for each of the statically-defined periodic handlers...
+ */
+#define PERIODIC_HANDLER_INDEX(handler, period) PERIODIC_##handler,
+enum periodic_handler_index {
+  TIMER_PERIODIC_HANDLERS(PERIODIC_HANDLER_INDEX)
+  PERIODIC_HANDLER_COUNT
+};
+
+/**
+ * ... and a countdown for each, which starts at the handler's period.
+ */
+#define PERIODIC_HANDLER_PERIOD(handler, period) period,
+static uint16_t periodic_countdowns[PERIODIC_HANDLER_COUNT] = {
+  TIMER_PERIODIC_HANDLERS(PERIODIC_HANDLER_PERIOD)
+};
 
 /**
- * Specifies how many fast ticks should pass before a slow tick is
- * triggered. For approximately one second, use 156,200.
+ * Bit-mask of the periodic handlers which are due to be dispatched.
  */
-static const uint16_t fast_ticks_per_slow_tick = 15620UL;
+static volatile uint8_t pending_periodic_handlers = 0;
 
 
 /**
@@ -51,60 +142,332 @@ static const uint16_t fast_ticks_per_slow_tick = 15620UL;
  */
 void set_up_timers() {
 
-  //Set up the timer that's used to determine brightness.
-  TCCR1B |= ((0 << CS12) | (0 << CS11) | (1 << CS10) | (1 << WGM12));
-  TIMSK1 |= (1 << OCIE1A);
-  OCR1A = 1023;
+  uint8_t i;
+
+  //If the timers are already running, there's nothing to do;
+  //re-initializing the wheel would lose any scheduled events.
+  if(TIMSK0 & (1 << OCIE0A)) {
+    return;
+  }
+
+  //Empty the timer wheel, and mark each event as free.
+  for(i = 0; i < TIMER_WHEEL_SIZE; ++i) {
+    timer_wheel[i] = NO_TIMER_EVENT;
+  }
+  for(i = 0; i < MAXIMUM_TIMER_EVENTS; ++i) {
+    timer_events[i].handler = 0;
+    timer_events[i].bucket = BUCKET_UNUSED;
+  }
+
+  //Set up Timer 0 to generate our ticks: in Clear on Timer Compare mode,
+  //counting CPU cycles divided by eight, with a period of 128 counts.
+  //This produces exactly 15,625 ticks per second at 16MHz.
+  TCCR0A = (1 << WGM01);
+  TCCR0B = (0 << CS02) | (1 << CS01) | (0 << CS00);
+  OCR0A = 127;
+
+  //Compare unit B matches at the very start of every period, so its flag is
+  //always set by the time the tick interrupt finishes. This lets the tick
+  //interrupt request a dispatch simply by enabling the compare B interrupt.
+  OCR0B = 0;
+
+  TIMSK0 |= (1 << OCIE0A);
 
 }
 
+
 /**
- * Registers a function which will be called whenever a "fast tick"
- * occurs. These events are called approximately 150 times per second.
- *
- * handler: A pointer to the function which will be called approximately
- *    150 times per second; or null to disable the fast tick handler.
+ * Places the given event into the timer wheel, such that it will occur
+ * once the given number of ticks have passed. Must be called with
+ * interrupts disabled.
+ */
+static void insert_timer_event(uint8_t index, uint16_t delay) {
+
+  volatile struct timer_event *event = &timer_events[index];
+  uint8_t bucket = (dispatched_bucket + delay) & TIMER_WHEEL_MASK;
+
+  //The event's bucket comes up once every TIMER_WHEEL_SIZE ticks;
+  //count how many times it needs to pass before the event is due.
+  event->rounds = (delay - 1) >> TIMER_WHEEL_BITS;
+
+  //Add the event to the front of its bucket.
+  event->bucket = bucket;
+  event->next = timer_wheel[bucket];
+  timer_wheel[bucket] = index;
+
+}
+
+
+/**
+ * Schedules a timer event, which will first occur after the given delay,
+ * and then repeat with the given period (or not at all, if period is zero).
+ */
+static TimerEvent schedule(TimerEventHandler handler, uint16_t delay, uint16_t period) {
+
+  TimerEvent index = NO_TIMER_EVENT;
+  uint8_t i;
+
+  //An event can't occur any sooner than the next tick.
+  if(!delay) {
+    delay = 1;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    //Find a free slot for the new event...
+    for(i = 0; i < MAXIMUM_TIMER_EVENTS; ++i) {
+      if(timer_events[i].bucket == BUCKET_UNUSED) {
+        index = i;
+        break;
+      }
+    }
+
+    //... and if we found one, schedule the event.
+    if(index != NO_TIMER_EVENT) {
+      timer_events[index].handler = handler;
+      timer_events[index].period = period;
+      insert_timer_event(index, delay);
+    }
+  }
+
+  return index;
+}
+
+
+/**
+ * Schedules a function which will be called repeatedly, once every
+ * given number of timer ticks.
+ */
+TimerEvent schedule_repeating_timer_event(TimerEventHandler handler, uint16_t period) {
+  return schedule(handler, period, period ? period : 1);
+}
+
+
+/**
+ * Schedules a function which will be called once, after the given
+ * number of timer ticks have passed.
+ */
+TimerEvent schedule_timer_event(TimerEventHandler handler, uint16_t delay) {
+  return schedule(handler, delay, 0);
+}
+
+
+/**
+ * Cancels a scheduled timer event.
+ */
+void cancel_timer_event(TimerEvent index) {
+
+  volatile uint8_t *link;
+  volatile struct timer_event *event;
+
+  if(index >= MAXIMUM_TIMER_EVENTS) {
+    return;
+  }
+
+  event = &timer_events[index];
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    //Ensure the event won't be called again.
+    event->handler = 0;
+    event->period = 0;
+
+    //If the event is in the wheel, remove it from its bucket, and free its slot.
+    //(Events that are currently being dispatched are freed once dispatch completes.)
+    if(event->bucket < TIMER_WHEEL_SIZE) {
+
+      for(link = &timer_wheel[event->bucket]; *link != NO_TIMER_EVENT; link = &timer_events[*link].next) {
+        if(*link == index) {
+          *link = event->next;
+          break;
+        }
+      }
+
+      event->bucket = BUCKET_UNUSED;
+    }
+  }
+}
+
+
+/**
+ * Returns the number of timer ticks which have elapsed since the timers
+ * were set up. Safe to call from interrupt context.
  */
-void register_fast_tick_handler(TimerEventHandler handler) {
-  fast_tick_handler = handler;
+uint32_t timer_ticks() {
+
+  uint32_t ticks;
+
+  //The count is updated by the tick interrupt, so it must be read atomically.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ticks = elapsed_ticks;
+  }
+
+  return ticks;
 }
 
 
 /**
- * Registers a function which will be called whenever a "slow tick"
- * occurs. These events are called approximately once per second.
+ * Returns the number of whole milliseconds which have elapsed since the
+ * timers were set up, and optionally the microseconds since the last.
+ */
+uint32_t uptime_milliseconds(uint16_t *microseconds) {
+
+  uint32_t milliseconds;
+  uint16_t remainder;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    milliseconds = elapsed_milliseconds;
+    remainder = millisecond_remainder;
+  }
+
+  if(microseconds) {
+    *microseconds = (uint32_t)remainder * 1000 / TIMER_TICKS_PER_SECOND;
+  }
+
+  return milliseconds;
+}
+
+
+/**
+ * Calls a per-tick handler directly, and counts down a periodic handler,
+ * marking it as pending once it comes due.
+ */
+#define CALL_TICK_HANDLER(handler) handler();
+#define COUNT_DOWN_PERIODIC_HANDLER(handler, period)                          \
+  if(!--periodic_countdowns[PERIODIC_##handler]) {                            \
+    periodic_countdowns[PERIODIC_##handler] = (period);                       \
+    pending_periodic_handlers |= (1 << PERIODIC_##handler);                   \
+  }
+
+/**
+ * Calls a periodic handler, if it's pending.
+ */
+#define DISPATCH_PERIODIC_HANDLER(handler, period)                            \
+  if(pending & (1 << PERIODIC_##handler)) {                                   \
+    handler();                                                                \
+  }
+
+
+/**
+ * Handler for the TIMER0 comparison event, which occurs 15,625 times per
+ * second.
  *
- * handler: A pointer to the function which will be called approximately
- *    once per second; or null to disable the slow tick handler.
+ * This interrupt is kept free of function calls: the per-tick handlers are
+ * called directly (and thus inlined), and any work which needs to call out
+ * is left to the dispatch interrupt below. This keeps the compiler from
+ * having to save and restore every call-clobbered register on each tick.
  */
-void register_slow_tick_handler(TimerEventHandler handler) {
-  slow_tick_handler = handler;
+ISR(TIMER0_COMPA_vect) {
+
+  PROFILE_ISR(PROFILE_TIMER_TICK);
+
+  uint8_t previous_bucket;
+
+  //Run each of the per-tick handlers...
+  TIMER_TICK_HANDLERS(CALL_TICK_HANDLER)
+
+  //... count down each of the periodic handlers...
+  TIMER_PERIODIC_HANDLERS(COUNT_DOWN_PERIODIC_HANDLER)
+
+  //... and advance the wheel by a single bucket.
+  previous_bucket = current_bucket;
+  current_bucket = (current_bucket + 1) & TIMER_WHEEL_MASK;
+  ++elapsed_ticks;
+
+  //Advance the millisecond clock by exactly one tick's worth of milliseconds.
+  millisecond_remainder += 1000;
+  if(millisecond_remainder >= TIMER_TICKS_PER_SECOND) {
+    millisecond_remainder -= TIMER_TICKS_PER_SECOND;
+    ++elapsed_milliseconds;
+  }
+
+  //If there's any work to dispatch, request the dispatch interrupt,
+  //which will run as soon as this one returns. Otherwise, if dispatch is
+  //up to date, the new bucket needs no processing; mark it as dispatched, so
+  //the wheel can never fall a whole lap (or more) behind, and new events are
+  //always placed relative to the current tick.
+  if(pending_periodic_handlers || timer_wheel[current_bucket] != NO_TIMER_EVENT) {
+    TIMSK0 |= (1 << OCIE0B);
+  } else if(dispatched_bucket == previous_bucket) {
+    dispatched_bucket = current_bucket;
+  }
+
 }
 
 
 /**
- * Handler for the TIMER1 comparison event, which
- * occurs at about 156,200Hz.
+ * Processes a single bucket of the timer wheel, calling any events which are due.
  */
-ISR(TIMER1_COMPA_vect) {
+static inline void dispatch_timer_wheel_bucket(uint8_t bucket) {
 
-  //Stores the number of fast ticks which have occurred
-  //since the last slow tick.
-  static uint16_t fast_ticks = 0;
+  volatile uint8_t *link;
+  volatile struct timer_event *event;
+  TimerEventHandler handler;
+  uint8_t index, expired = NO_TIMER_EVENT;
 
-  //Count a single timer "fast tick",
-  //which are used to generate the slow tick function.
-  fast_ticks = (fast_ticks + 1) % fast_ticks_per_slow_tick;
+  //Walk the bucket, counting down each event's rounds;
+  //move any events which are due onto a separate "expired" list.
+  link = &timer_wheel[bucket];
+  while((index = *link) != NO_TIMER_EVENT) {
+    event = &timer_events[index];
 
-  //If we have a valid fast tick handler, run it.
-  if(fast_tick_handler) {
-    fast_tick_handler();
+    if(event->rounds) {
+      --event->rounds;
+      link = &event->next;
+    } else {
+      *link = event->next;
+      event->next = expired;
+      event->bucket = BUCKET_EXPIRING;
+      expired = index;
+    }
   }
 
-  //If our fast tick handler has just "wrapped around" to zero,
-  //and we have a valid slow tick handler, run that handler.
-  if(slow_tick_handler && !fast_ticks) {
-    slow_tick_handler();
+  //Dispatch each of the expired events. Repeating events are re-inserted
+  //before their handlers are called, so a handler can cancel its own event.
+  while(expired != NO_TIMER_EVENT) {
+    index = expired;
+    event = &timer_events[index];
+    expired = event->next;
+
+    handler = event->handler;
+
+    if(handler && event->period) {
+      insert_timer_event(index, event->period);
+    } else {
+      event->handler = 0;
+      event->bucket = BUCKET_UNUSED;
+    }
+
+    if(handler) {
+      handler();
+    }
+  }
+
+}
+
+
+/**
+ * Dispatch interrupt, which is requested by the tick interrupt whenever a
+ * periodic handler or timer wheel event may be due.
+ */
+ISR(TIMER0_COMPB_vect) {
+
+  PROFILE_ISR(PROFILE_TIMER_DISPATCH);
+
+  uint8_t pending = pending_periodic_handlers;
+
+  //This interrupt only runs on request.
+  TIMSK0 &= ~(1 << OCIE0B);
+  pending_periodic_handlers = 0;
+
+  //Call each of the statically-defined periodic handlers that are due...
+  TIMER_PERIODIC_HANDLERS(DISPATCH_PERIODIC_HANDLER)
+
+  //... and process the timer wheel. If other interrupts have held us off for
+  //more than a tick, catch up on every bucket the wheel has passed.
+  while(dispatched_bucket != current_bucket) {
+    dispatched_bucket = (dispatched_bucket + 1) & TIMER_WHEEL_MASK;
+    dispatch_timer_wheel_bucket(dispatched_bucket);
   }
 
 }
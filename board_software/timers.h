@@ -33,11 +33,29 @@
 #include <avr/interrupt.h>
 
 /**
- * Define the RecieveHandler type, which stores a pointer to a function which
- * should handle any recieved bytes.
+ * Define the TimerEventHandler type, which stores a pointer to a function
+ * which should be called when a timer event occurs.
  */
 typedef void (*TimerEventHandler)();
 
+/**
+ * Handle which identifies a scheduled timer event, and which can be used
+ * to cancel it. NO_TIMER_EVENT is used to indicate the lack of an event.
+ */
+typedef uint8_t TimerEvent;
+#define NO_TIMER_EVENT 0xFF
+
+/**
+ * The rate at which timer "ticks" occur. Timer 0 counts 1024 CPU cycles
+ * per tick, so at 16MHz, this is exactly 15,625 ticks per second.
+ */
+#define TIMER_TICKS_PER_SECOND (F_CPU / 1024UL)
+
+/**
+ * The maximum number of timer events which can be scheduled at once.
+ */
+#define MAXIMUM_TIMER_EVENTS 8
+
 /**
  * Set up each of the internal hardware timers for use by the timer module.
  * This enables use of the various timer functions provided below.
@@ -49,23 +67,51 @@ typedef void (*TimerEventHandler)();
 void set_up_timers();
 
 /**
- * Registers a function which will be called whenever a "fast tick"
- * occurs. These events are called approximately 150 times per second.
+ * Schedules a function which will be called repeatedly, once every
+ * given number of timer ticks.
+ *
+ * handler: A pointer to the function to be called.
+ * period: The number of ticks between calls; at least one.
+ *
+ * Returns a handle to the scheduled event, or NO_TIMER_EVENT if
+ * no more events can be scheduled.
+ */
+TimerEvent schedule_repeating_timer_event(TimerEventHandler handler, uint16_t period);
+
+/**
+ * Schedules a function which will be called once, after the given
+ * number of timer ticks have passed.
+ *
+ * handler: A pointer to the function to be called.
+ * delay: The number of ticks to wait before calling the handler; at least one.
  *
- * handler: A pointer to the function which will be called approximately
- *    150 times per second.
+ * Returns a handle to the scheduled event, or NO_TIMER_EVENT if
+ * no more events can be scheduled.
  */
-void register_fast_tick_handler(TimerEventHandler handler);
+TimerEvent schedule_timer_event(TimerEventHandler handler, uint16_t delay);
 
 /**
- * Registers a function which will be called whenever a "slow tick"
- * occurs. These events are called approximately once per second.
+ * Cancels a scheduled timer event. Cancelling NO_TIMER_EVENT has no effect.
  *
- * handler: A pointer to the function which will be called approximately
- *    once per second; or null to disable the slow tick handler.
+ * Note that the handle for a single event becomes invalid once that
+ * event has occurred, as its slot may be reused for another event.
  */
-void register_slow_tick_handler(TimerEventHandler handler);
+void cancel_timer_event(TimerEvent event);
 
+/**
+ * Returns the number of timer ticks which have elapsed since the timers
+ * were set up; this wraps roughly every 76 hours. Safe to call from
+ * interrupt context.
+ */
+uint32_t timer_ticks();
+
+/**
+ * Returns the number of whole milliseconds which have elapsed since the
+ * timers were set up; this wraps roughly every 49 days. If microseconds is
+ * non-null, it receives the time elapsed since the last whole millisecond,
+ * in microseconds. Safe to call from interrupt context.
+ */
+uint32_t uptime_milliseconds(uint16_t *microseconds);
 
 
 #endif
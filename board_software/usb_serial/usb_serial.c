@@ -29,9 +29,12 @@
 // Version 1.5: add support for Teensy 2.0
 // Version 1.6: fix zero length packet bug
 // Version 1.7: fix usb_serial_set_control
+// Local change: receive into a RAM buffer from the endpoint interrupt
+// Local change: optional interrupt profiling (see ../profiler.h)
 
 #define USB_SERIAL_PRIVATE_INCLUDE
 #include "usb_serial.h"
+#include "../profiler.h"
 
 //Disable the -Wstrict-aliasing function for this file, as this is third
 //party code; and we're not going to change it to "fix" the relevant style
@@ -97,6 +100,25 @@
 // operating systems.
 #define SUPPORT_ENDPOINT_HALT
 
+// Data received from the PC is copied out of the USB endpoint by the
+// endpoint interrupt, into a RAM buffer of this many bytes (a power of
+// two).  When the buffer fills, the endpoint interrupt is paused, and
+// the PC is NAKed until the program reads some data.
+#define RECEIVE_BUFFER_SIZE	64
+
+// The endpoint interrupt copies at most this many bytes each time it
+// runs, as it does so with interrupts masked; this bounds the delay it
+// adds to the IR receive interrupt.  If more data is waiting, the
+// endpoint interrupt is paused until the program reads some data, as
+// though the buffer were full, so other interrupts can run in between.
+#define RECEIVE_BYTES_PER_INTERRUPT	16
+
+// Data queued by usb_serial_queue is held in a RAM buffer of this many
+// bytes (a power of two, up to 256), and moved into the USB endpoint by
+// the start-of-frame interrupt, so the program never waits on the PC.
+// When the buffer is full, usb_serial_queue fails, rather than waiting.
+#define TRANSMIT_BUFFER_SIZE	256
+
 
 
 /**************************************************************************
@@ -310,6 +332,24 @@ static uint8_t transmit_previous_timeout=0;
 static uint8_t cdc_line_coding[7]={0x00, 0xE1, 0x00, 0x00, 0x00, 0x00, 0x08};
 static uint8_t cdc_line_rtsdtr=0;
 
+// data received from the PC, waiting to be read by the program; the
+// endpoint interrupt adds at the head, and the program reads at the tail
+static volatile uint8_t receive_buffer[RECEIVE_BUFFER_SIZE];
+static volatile uint8_t receive_head=0, receive_tail=0;
+
+// non-zero while the receive interrupt is paused for lack of buffer
+// space, or after it's copied RECEIVE_BYTES_PER_INTERRUPT bytes
+static volatile uint8_t receive_paused=0;
+
+// data queued to be sent to the PC; the program adds at the head, and
+// the start-of-frame interrupt moves it into the endpoint from the tail
+static volatile uint8_t transmit_buffer[TRANSMIT_BUFFER_SIZE];
+static volatile uint8_t transmit_head=0, transmit_tail=0;
+
+// non-zero once the program has asked for the queued data to be released
+// to the PC as soon as it's all in the endpoint; see usb_serial_release
+static volatile uint8_t transmit_release=0;
+
 
 /**************************************************************************
  *
@@ -339,57 +379,42 @@ uint8_t usb_configured(void)
 	return usb_configuration;
 }
 
-// get the next character, or -1 if nothing received
-int16_t usb_serial_getchar(void)
+// resume the receive interrupt, if it was paused because the buffer
+// was full; any data waiting in the endpoint is then copied at once
+static inline void usb_resume_receive(void)
 {
-	uint8_t c, intr_state;
+	uint8_t intr_state;
 
-	// interrupts are disabled so these functions can be
-	// used from the main program or interrupt context,
-	// even both in the same program!
+	if (!receive_paused) return;
 	intr_state = SREG;
 	cli();
-	if (!usb_configuration) {
-		SREG = intr_state;
-		return -1;
-	}
-	UENUM = CDC_RX_ENDPOINT;
-	retry:
-	c = UEINTX;
-	if (!(c & (1<<RWAL))) {
-		// no data in buffer
-		if (c & (1<<RXOUTI)) {
-			UEINTX = 0x6B;
-			goto retry;
-		}	
-		SREG = intr_state;
-		return -1;
+	receive_paused = 0;
+	if (usb_configuration) {
+		UENUM = CDC_RX_ENDPOINT;
+		UEIENX = (1<<RXOUTE);
 	}
-	// take one byte out of the buffer
-	c = UEDATX;
-	// if buffer completely used, release it
-	if (!(UEINTX & (1<<RWAL))) UEINTX = 0x6B;
 	SREG = intr_state;
+}
+
+// get the next character, or -1 if nothing received
+int16_t usb_serial_getchar(void)
+{
+	uint8_t c, tail;
+
+	// the receive buffer has a single reader and a single writer,
+	// so no interrupt masking is needed to take a byte from it
+	tail = receive_tail;
+	if (tail == receive_head) return -1;
+	c = receive_buffer[tail];
+	receive_tail = (tail + 1) & (RECEIVE_BUFFER_SIZE - 1);
+	usb_resume_receive();
 	return c;
 }
 
 // number of bytes available in the receive buffer
 uint8_t usb_serial_available(void)
 {
-	uint8_t n=0, i, intr_state;
-
-	intr_state = SREG;
-	cli();
-	if (usb_configuration) {
-		UENUM = CDC_RX_ENDPOINT;
-		n = UEBCLX;
-		if (!n) {
-			i = UEINTX;
-			if (i & (1<<RXOUTI) && !(i & (1<<RWAL))) UEINTX = 0x6B;
-		}
-	}
-	SREG = intr_state;
-	return n;
+	return (receive_head - receive_tail) & (RECEIVE_BUFFER_SIZE - 1);
 }
 
 // discard any buffered input
@@ -404,6 +429,9 @@ void usb_serial_flush_input(void)
 		while ((UEINTX & (1<<RWAL))) {
 			UEINTX = 0x6B; 
 		}
+		receive_tail = receive_head;
+		receive_paused = 0;
+		UEIENX = (1<<RXOUTE);
 		SREG = intr_state;
 	}
 }
@@ -625,6 +653,72 @@ int8_t usb_serial_write(const uint8_t *buffer, uint16_t size)
 }
 
 
+// move as much queued data into the endpoint as it will take, without
+// waiting; once everything queued is in the endpoint, release any partial
+// packet if the program asked for it.  Must be called with interrupts
+// disabled.
+static void usb_transmit_queued(void)
+{
+	uint8_t tail = transmit_tail, moved = 0;
+
+	UENUM = CDC_TX_ENDPOINT;
+	while (tail != transmit_head && (UEINTX & (1<<RWAL))) {
+		UEDATX = transmit_buffer[tail];
+		tail = (tail + 1) & (TRANSMIT_BUFFER_SIZE - 1);
+		moved = 1;
+		// if this completed a packet, transmit it now!
+		if (!(UEINTX & (1<<RWAL))) UEINTX = 0x3A;
+	}
+	transmit_tail = tail;
+	if (moved) transmit_flush_timer = TRANSMIT_FLUSH_TIMEOUT;
+	if (transmit_release && tail == transmit_head) {
+		transmit_release = 0;
+		if (transmit_flush_timer) {
+			UEINTX = 0x3A;
+			transmit_flush_timer = 0;
+		}
+	}
+}
+
+// queue a buffer for transmission, without waiting; the data is moved
+// into the endpoint by the start-of-frame interrupt (or usb_serial_release).
+//  0 returned on success, -1 (with nothing queued) if the buffer can't
+//  hold all of it, or the USB isn't configured.
+// Only the main program may queue data, and it shouldn't be mixed with
+// the functions above, which write to the endpoint directly.
+int8_t usb_serial_queue(const uint8_t *buffer, uint8_t size)
+{
+	uint8_t head;
+
+	if (!usb_configuration) return -1;
+	// the transmit buffer has a single reader and a single writer,
+	// so no interrupt masking is needed to add to it
+	head = transmit_head;
+	if (size > ((transmit_tail - head - 1) & (TRANSMIT_BUFFER_SIZE - 1))) return -1;
+	while (size--) {
+		transmit_buffer[head] = *buffer++;
+		head = (head + 1) & (TRANSMIT_BUFFER_SIZE - 1);
+	}
+	transmit_head = head;
+	return 0;
+}
+
+// release the queued data to the PC as soon as possible, rather than
+// after the flush timeout.  Whatever the endpoint can take is moved into
+// it at once; anything else follows from the start-of-frame interrupt.
+// This never waits for the PC.
+void usb_serial_release(void)
+{
+	uint8_t intr_state;
+
+	if (!usb_configuration) return;
+	intr_state = SREG;
+	cli();
+	transmit_release = 1;
+	usb_transmit_queued();
+	SREG = intr_state;
+}
+
 // immediately transmit any buffered output.
 // This doesn't actually transmit the data - that is impossible!
 // USB devices only transmit when the host allows, so the best
@@ -723,6 +817,7 @@ int8_t usb_serial_set_control(uint8_t signals)
 ISR(USB_GEN_vect)
 {
 	uint8_t intbits, t;
+	PROFILE_ISR(PROFILE_USB_GENERAL);
 
         intbits = UDINT;
         UDINT = 0;
@@ -734,9 +829,12 @@ ISR(USB_GEN_vect)
 		UEIENX = (1<<RXSTPE);
 		usb_configuration = 0;
 		cdc_line_rtsdtr = 0;
+		transmit_tail = transmit_head;
+		transmit_release = 0;
         }
 	if (intbits & (1<<SOFI)) {
 		if (usb_configuration) {
+			usb_transmit_queued();
 			t = transmit_flush_timer;
 			if (t) {
 				transmit_flush_timer = --t;
@@ -770,9 +868,42 @@ static inline void usb_ack_out(void)
 
 
 
-// USB Endpoint Interrupt - endpoint 0 is handled here.  The
-// other endpoints are manipulated by the user-callable
-// functions, and the start-of-frame interrupt.
+// Copy received data out of the CDC OUT endpoint and into the
+// receive buffer, releasing each bank once it's been emptied.
+// If the buffer fills, or RECEIVE_BYTES_PER_INTERRUPT bytes have
+// been copied, the receive interrupt is paused; the remaining data
+// stays in the endpoint until usb_serial_getchar resumes it.
+static inline void usb_receive_out(void)
+{
+	uint8_t head, next, n, budget = RECEIVE_BYTES_PER_INTERRUPT;
+
+	UENUM = CDC_RX_ENDPOINT;
+	head = receive_head;
+	while (UEINTX & (1<<RXOUTI)) {
+		// copy as much of this bank as will fit
+		for (n = UEBCLX; n; n--) {
+			next = (head + 1) & (RECEIVE_BUFFER_SIZE - 1);
+			if (next == receive_tail || !budget) {
+				receive_head = head;
+				receive_paused = 1;
+				UEIENX = 0;
+				return;
+			}
+			receive_buffer[head] = UEDATX;
+			head = next;
+			budget--;
+		}
+		// release the (now empty) bank
+		UEINTX = 0x6B;
+	}
+	receive_head = head;
+}
+
+
+// USB Endpoint Interrupt - endpoint 0 is handled here, as is the
+// receipt of data on the CDC OUT endpoint.  The other endpoints are
+// manipulated by the user-callable functions, and the start-of-frame
+// interrupt.
 //
 ISR(USB_COM_vect)
 {
@@ -789,7 +920,13 @@ ISR(USB_COM_vect)
 	uint16_t desc_val;
 	const uint8_t *desc_addr;
 	uint8_t	desc_length;
+	PROFILE_ISR(PROFILE_USB_ENDPOINT);
 
+	if (UEINT & (1<<CDC_RX_ENDPOINT)) {
+		usb_receive_out();
+		// if this was the only endpoint with news, we're done
+		if (!(UEINT & (1<<0))) return;
+	}
         UENUM = 0;
         intbits = UEINTX;
         if (intbits & (1<<RXSTPI)) {
@@ -867,6 +1004,10 @@ ISR(USB_COM_vect)
 			}
         		UERST = 0x1E;
         		UERST = 0;
+			receive_head = receive_tail = 0;
+			receive_paused = 0;
+			UENUM = CDC_RX_ENDPOINT;
+			UEIENX = (1<<RXOUTE);
 			return;
 		}
 		if (bRequest == GET_CONFIGURATION && bmRequestType == 0x80) {
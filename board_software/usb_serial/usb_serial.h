@@ -17,6 +17,8 @@ int8_t usb_serial_putchar(uint8_t c);	// transmit a character
 int8_t usb_serial_putchar_nowait(uint8_t c);  // transmit a character, do not wait
 int8_t usb_serial_write(const uint8_t *buffer, uint16_t size); // transmit a buffer
 void usb_serial_flush_output(void);	// immediately transmit any buffered output
+int8_t usb_serial_queue(const uint8_t *buffer, uint8_t size); // queue a buffer, do not wait
+void usb_serial_release(void);		// send queued output as soon as possible
 
 // serial parameters
 uint32_t usb_serial_get_baud(void);	// get the baud rate
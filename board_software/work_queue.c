@@ -0,0 +1,108 @@
+/**
+ * work_queue.c
+ * A small deferred-work queue for the JD Beacon Board. Interrupt handlers
+ * post work items, which are then run from the main loop, with interrupts
+ * enabled; this keeps the interrupt handlers short and their run time bounded.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <util/atomic.h>
+
+#include "counters.h"
+#include "work_queue.h"
+
+/**
+ * A single deferred work item.
+ */
+struct work_item {
+  WorkHandler handler;
+  uint16_t argument;
+};
+
+/**
+ * The queue itself: a ring buffer of work items. Items are added at the head
+ * (by any context) and removed at the tail (by the main loop only).
+ */
+static struct work_item queue[WORK_QUEUE_SIZE];
+volatile static uint8_t queue_head = 0;
+volatile static uint8_t queue_tail = 0;
+
+
+/**
+ * Queues the given handler to be called, with the given argument, from the
+ * main loop. Safe to call from interrupt context.
+ *
+ * Returns true if the work was queued, or false if the queue was full
+ * (in which case the work is dropped, and counted as an overrun).
+ */
+bool post_work(WorkHandler handler, uint16_t argument) {
+
+  bool queued = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+    uint8_t next = (queue_head + 1) & (WORK_QUEUE_SIZE - 1);
+
+    //If the queue is full, drop the work, and note that we've done so.
+    if(next == queue_tail) {
+      count_event(COUNTER_WORK_OVERRUNS);
+    }
+    //Otherwise, add it to the queue.
+    else {
+      queue[queue_head].handler = handler;
+      queue[queue_head].argument = argument;
+      queue_head = next;
+      queued = true;
+    }
+  }
+
+  return queued;
+}
+
+
+/**
+ * Returns true iff there's work waiting to be run.
+ */
+bool work_pending() {
+  return queue_head != queue_tail;
+}
+
+
+/**
+ * Runs each of the work items which are currently waiting, in the order
+ * they were posted. Should only be called from the main loop.
+ */
+void run_pending_work() {
+
+  while(work_pending()) {
+
+    //Only the main loop removes items, so the item at the tail can't change
+    //underneath us; it's copied out before its slot is released.
+    struct work_item item = queue[queue_tail];
+    queue_tail = (queue_tail + 1) & (WORK_QUEUE_SIZE - 1);
+
+    item.handler(item.argument);
+  }
+}
@@ -0,0 +1,69 @@
+/**
+ * work_queue.h
+ * A small deferred-work queue for the JD Beacon Board. Interrupt handlers
+ * post work items, which are then run from the main loop, with interrupts
+ * enabled; this keeps the interrupt handlers short and their run time bounded.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+ * Copyright (c) 2014 Binghamton University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __WORK_QUEUE_H__
+#define __WORK_QUEUE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The maximum number of work items which can be waiting at once.
+ * Must be a power of two.
+ */
+#define WORK_QUEUE_SIZE 8
+
+/**
+ * Type for a deferred work handler, which accepts a single (word) argument.
+ */
+typedef void (*WorkHandler)(uint16_t);
+
+/**
+ * Queues the given handler to be called, with the given argument, from the
+ * main loop. Safe to call from interrupt context.
+ *
+ * Returns true if the work was queued, or false if the queue was full
+ * (in which case the work is dropped, and counted as an overrun;
+ * see counters.h).
+ */
+bool post_work(WorkHandler handler, uint16_t argument);
+
+/**
+ * Returns true iff there's work waiting to be run.
+ */
+bool work_pending();
+
+/**
+ * Runs each of the work items which are currently waiting, in the order
+ * they were posted. Should only be called from the main loop.
+ */
+void run_pending_work();
+
+#endif
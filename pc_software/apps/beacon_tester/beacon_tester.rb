@@ -48,7 +48,8 @@ def adjust_board_state(&block)
   begin
     JDBeacon::Board.open(&block) if block
     JDBeacon::Board.open do |board| 
-      JSON::generate(board.state.snapshot.merge(:claim_code => board.claim_code, :last_claim => board.last_claim_attempt))
+      status = board.snapshot
+      JSON::generate(status[:state].snapshot.merge(:claim_code => status[:claim_code], :last_claim => status[:last_claim_attempt]))
     end
   rescue StandardError => e
     JSON::generate({:error => e.class, :message => e.to_s, :backtrace => e.backtrace})
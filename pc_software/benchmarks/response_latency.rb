@@ -0,0 +1,135 @@
+#!/usr/bin/env ruby
+#
+# Measures the round-trip time of the beacon board's requests: the time from
+# sending a request to receiving its complete response. Results can be saved,
+# and compared against a later run; e.g. to compare two firmware builds:
+#
+#   response_latency.rb --virtual old/virtual_beacon --save before.json
+#   response_latency.rb --virtual new/virtual_beacon --baseline before.json
+#
+# Without --virtual, the first connected board is used (see Board.open);
+# or the board on the given serial port.
+#
+# The MIT License (MIT)
+# 
+# Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+# Copyright (c) 2014 Binghamton University
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+$LOAD_PATH.unshift File.expand_path('../../lib', __FILE__)
+
+require 'jd_beacon'
+require 'json'
+require 'optparse'
+require 'io/console'
+require_relative '../spec/support/virtual_field'
+
+#
+# Each of the measured requests, and how to perform it.
+#
+REQUESTS = {
+  'state'          => lambda { |board| board.state },
+  'claim_code'     => lambda { |board| board.claim_code },
+  'last_claim'     => lambda { |board| board.last_claim_attempt },
+  'counters'       => lambda { |board| board.counters },
+  'snapshot'       => lambda { |board| board.snapshot },
+  'three_in_order' => lambda { |board| board.state; board.claim_code; board.last_claim_attempt },
+  'three_tagged'   => lambda do |board|
+    board.perform_requests([JDBeacon::Board::REQUEST_CLAIM_CODE], [JDBeacon::Board::REQUEST_LAST_CLAIM], [JDBeacon::Board::REQUEST_SNAPSHOT])
+  end
+}
+
+#
+# Returns the given percentile of a sorted list of samples.
+#
+def percentile(samples, fraction)
+  samples[((samples.length - 1) * fraction).round]
+end
+
+#
+# Performs the given request repeatedly, and returns a summary of
+# its round-trip times, in milliseconds.
+#
+def measure(board, request, iterations)
+
+  #Let the board settle, and the serial port's buffers fill, before we start.
+  3.times { request[board] }
+
+  samples = Array.new(iterations) do
+    started = Time.now
+    request[board]
+    (Time.now - started) * 1000
+  end.sort
+
+  {
+    'median' => percentile(samples, 0.5),
+    'p90'    => percentile(samples, 0.9),
+    'max'    => samples.last
+  }
+
+end
+
+
+options = { :iterations => 200 }
+
+OptionParser.new do |parser|
+  parser.banner = "usage: #{$0} [options] [serial_port]"
+  parser.on('-n', '--iterations N', Integer, 'Round trips per request (default 200)') { |n| options[:iterations] = n }
+  parser.on('--virtual PATH', 'Starts and measures the virtual beacon at PATH') { |path| options[:virtual] = path }
+  parser.on('--save FILE', 'Saves the results as JSON') { |file| options[:save] = file }
+  parser.on('--baseline FILE', 'Compares the results with those saved in FILE') { |file| options[:baseline] = file }
+end.parse!
+
+field = options[:virtual] && JDBeacon::VirtualField.new(1, options[:virtual])
+port  = field ? File.realpath(field.usb_path) : ARGV.first
+
+begin
+
+  results = JDBeacon::Board.open(*[port].compact) do |board|
+
+    #Serial ports to virtual beacons are terminals, which must be raw.
+    board.instance_variable_get(:@serial_port).raw! if options[:virtual]
+
+    board.mode = :on
+    Hash[REQUESTS.map { |name, request| [name, measure(board, request, options[:iterations])] }]
+
+  end
+
+ensure
+  field.stop if field
+end
+
+baseline = options[:baseline] ? JSON.parse(File.read(options[:baseline])) : {}
+
+puts "%-16s %10s %10s %10s %s" % ['request (ms)', 'median', 'p90', 'max', baseline.empty? ? '' : '  baseline median']
+results.each do |name, summary|
+
+  line = "%-16s %10.2f %10.2f %10.2f" % [name, summary['median'], summary['p90'], summary['max']]
+
+  if baseline[name]
+    line << "   %10.2f (%+.0f%%)" % [baseline[name]['median'], (summary['median'] / baseline[name]['median'] - 1) * 100]
+  end
+
+  puts line
+
+end
+
+File.write(options[:save], JSON.pretty_generate(results)) if options[:save]
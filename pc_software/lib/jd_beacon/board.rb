@@ -24,9 +24,11 @@
 
 require 'serialport'
 require 'forwardable'
+require 'stringio'
 require 'require_all'
 
 require 'jd_beacon/state'
+require 'jd_beacon/claim_history'
 require 'jd_beacon/errors'
 require_rel 'enumerators'
 
@@ -45,8 +47,95 @@ module JDBeacon
     NULL_REQUEST = State.new(:mode => 31)
 
     #TODO: Abstract
-    REQUEST_CLAIM_CODE = 28
-    REQUEST_LAST_CLAIM = 29
+    REQUEST_TAGGED        = 17
+    REQUEST_SNAPSHOT      = 18
+    REQUEST_SCHEDULE_MODE = 19
+    REQUEST_TIME_SYNC     = 20
+    REQUEST_SYNC_TRANSMIT_FRAME = 21
+    REQUEST_TRANSMIT_LATENCY = 22
+    REQUEST_SET_PARAMETER = 23
+    REQUEST_ISR_PROFILE   = 24
+    REQUEST_COUNTERS      = 25
+    REQUEST_CLAIM_HISTORY = 26
+    REQUEST_CLAIM_CODE    = 28
+    REQUEST_LAST_CLAIM    = 29
+
+    # The names of each of the board's performance counters, in the order
+    # in which the board reports them.
+    COUNTER_NAMES = [
+      :ir_bytes_received,
+      :ir_framing_errors,
+      :valid_claims,
+      :rejected_claims,
+      :ir_transmissions,
+      :usb_timeouts,
+      :work_overruns,
+      :throttled_claims,
+      :ir_echoes,
+      :usb_overflows
+    ]
+
+    # The parameters which can be adjusted with set_parameter,
+    # and the numbers by which the board knows them.
+    PARAMETERS = {
+      :maximum_allowed_errors => 0,
+      :claim_window_size      => 1,
+      :claim_grace_period     => 2,
+      :claim_rate             => 3,
+      :claim_burst            => 4,
+      :ir_baud_rate           => 5,
+      :transmit_interval      => 6,
+      :transmit_burst         => 7,
+      :transmit_jitter        => 8,
+      :transmit_frame         => 9,
+      :transmit_slot          => 10,
+      :events                 => 11
+    }
+
+    # The events the board can push to us without being asked (see events=),
+    # and the numbers by which the board knows them.
+    EVENTS = {
+      :state_changed => 0,
+      :claim_attempt => 1
+    }
+
+    # The tag with which the board marks the events it pushes to us, in place
+    # of the tag of a tagged request; it's never given to a request.
+    EVENT_TAG = 0xFF
+
+    #
+    # An event pushed to us by the board: the board, the event's type (see
+    # EVENTS), and its data: the board's new State for a :state_changed
+    # event, or a ClaimEvent for a :claim_attempt event.
+    #
+    Event = Struct.new(:board, :type, :data)
+
+    # The IR signaling rates the board supports, in baud, slowest first.
+    # The board starts at the slowest.
+    IR_BAUD_RATES = [300, 600, 1200, 2400, 4800]
+
+    # The board's response to an invalid parameter request.
+    NO_PARAMETER_VALUE = 0xFFFF
+
+    # The board's response to a transmit latency request, when it hasn't
+    # transmitted since it last started transmitting claim codes.
+    NO_TRANSMIT_LATENCY = 0xFFFFFFFF
+
+    # The number of timestamp exchanges performed by each clock synchronization,
+    # and the number of synchronizations used to estimate the board's drift.
+    CLOCK_SYNC_EXCHANGES = 8
+    CLOCK_SAMPLE_HISTORY = 16
+
+    # The names of each of the interrupts the board can profile, in the order
+    # in which the board reports them.
+    PROFILED_ISR_NAMES = [
+      :timer_tick,
+      :timer_dispatch,
+      :ir_receive,
+      :ir_transmit,
+      :usb_general,
+      :usb_endpoint
+    ]
 
     attr_reader :filename
 
@@ -104,6 +193,21 @@ module JDBeacon
       @serial_port = serial_port
       @serial_port.read_timeout = READ_TIMEOUT
 
+      #Pairs of simultaneous [board, host] times, gathered by synchronize_clock.
+      @clock_samples = []
+
+      #The tags of any tagged requests which are awaiting responses, and
+      #any responses which have arrived before they were asked for.
+      @outstanding_tags  = []
+      @tagged_responses  = {}
+      @next_tag          = 0
+
+      #Any events which the board has pushed to us, which haven't yet been
+      #processed, and the blocks which handle them; see events=.
+      @events_enabled    = false
+      @pending_events    = []
+      @event_handlers    = []
+
     end
 
     #
@@ -117,16 +221,22 @@ module JDBeacon
     # Returns the beacon board's current state.
     #
     def state
-      send_state(NULL_REQUEST)
-      receive_state
+      exchange_state(NULL_REQUEST)
     end
 
     #
     # Sets the state of the beacon board.
     #
     def state=(new_state)
-      send_state(new_state)
-      receive_state
+      exchange_state(new_state)
+    end
+
+    #
+    # Returns the serial port on which the board is connected, so the board
+    # can be passed to IO.select, e.g. to wait for events from several boards.
+    #
+    def to_io
+      @serial_port
     end
 
     #
@@ -181,6 +291,447 @@ module JDBeacon
 
     end
 
+    #
+    # Returns the board's status as a hash, in a single request: its :state,
+    # its :claim_code, its :last_claim_attempt (as returned by
+    # last_claim_attempt, which this also clears), and its :counters (as
+    # returned by counters, except that the board's counters aren't cleared).
+    #
+    def snapshot
+
+      #The board reports everything but its counters in a fixed layout;
+      #then how many counters it has, and each of them.
+      response = request_stream(REQUEST_SNAPSHOT)
+      state, claim_code, last_claim, count = response.read(5).unpack("aCs>C")
+      values = response.read(count * 2).unpack("n*")
+
+      {
+        :state              => State.read(state),
+        :claim_code         => claim_code,
+        :last_claim_attempt => (last_claim == -1) ? nil : last_claim,
+        :counters           => name_counters(values)
+      }
+
+    end
+
+    #
+    # Sets one of the board's parameters (see PARAMETERS) to the given value,
+    # which must fit in a word. The board limits the value to those it
+    # supports; returns the value that was actually applied.
+    #
+    def set_parameter(name, value)
+
+      #Send the parameter's number and value, and receive the applied value.
+      number  = PARAMETERS.fetch(name)
+      applied = perform_request(REQUEST_SET_PARAMETER, 2, [number, value].pack("Cn")).unpack("n").first
+
+      raise ArgumentError, "the board did not accept the parameter #{name}" if applied == NO_PARAMETER_VALUE
+      applied
+
+    end
+
+    #
+    # Sets the number of bit errors a robot's response may contain,
+    # and still claim the board.
+    #
+    def maximum_allowed_errors=(errors)
+      set_parameter(:maximum_allowed_errors, errors)
+    end
+
+    #
+    # Sets the number of claim codes, including the current one, to which
+    # the board will accept responses.
+    #
+    def claim_window_size=(size)
+      set_parameter(:claim_window_size, size)
+    end
+
+    #
+    # Sets how long the board continues to accept responses to a claim code
+    # after it's been replaced by a new one, in seconds (up to sixty).
+    #
+    def claim_grace_period=(seconds)
+      set_parameter(:claim_grace_period, (seconds * 1000).round)
+    end
+
+    #
+    # Sets the rate at which robots may attempt to claim the board,
+    # in attempts per second. Faster attempts are throttled.
+    #
+    def claim_rate=(attempts_per_second)
+      set_parameter(:claim_rate, attempts_per_second)
+    end
+
+    #
+    # Sets the number of claim attempts a robot may make in quick succession,
+    # before it's limited to the claim rate.
+    #
+    def claim_burst=(attempts)
+      set_parameter(:claim_burst, attempts)
+    end
+
+    #
+    # Sets the time between the board's claim code transmissions, in seconds
+    # (up to four).
+    #
+    def transmit_interval=(seconds)
+      set_parameter(:transmit_interval, (seconds * 1000).round)
+    end
+
+    #
+    # Sets the number of times each claim code is transmitted, back to back.
+    #
+    def transmit_burst=(transmissions)
+      set_parameter(:transmit_burst, transmissions)
+    end
+
+    #
+    # Sets the largest amount by which the board randomly lengthens or
+    # shortens each interval between transmissions, in seconds. This keeps
+    # neighbouring boards from transmitting in lockstep.
+    #
+    def transmit_jitter=(seconds)
+      set_parameter(:transmit_jitter, (seconds * 1000).round)
+    end
+
+    #
+    # Sets the length of the frame shared by the beacons on a field, in seconds
+    # (up to four), in which each beacon transmits in its own slot. While this
+    # is non-zero, the board transmits once per frame, and ignores its transmit
+    # interval and jitter; zero returns to the interval.
+    #
+    def transmit_frame=(seconds)
+      set_parameter(:transmit_frame, (seconds * 1000).round)
+    end
+
+    #
+    # Sets the start of the board's transmit slot, in seconds from the start
+    # of each frame.
+    #
+    def transmit_slot=(seconds)
+      set_parameter(:transmit_slot, (seconds * 1000).round)
+    end
+
+    #
+    # Aligns the board's transmit frames with the host's clock, given the time
+    # at which some frame started, and the frame length in seconds. Boards
+    # synchronized to the same frame never transmit in each other's slots;
+    # since their clocks drift, this should be repeated every few seconds.
+    #
+    def synchronize_transmit_frame(frame_started_at, frame_length)
+      position = ((Time.now - frame_started_at) % frame_length * 1000).floor
+      perform_request(REQUEST_SYNC_TRANSMIT_FRAME, 0, [position].pack("n"))
+    end
+
+    #
+    # Returns how long the board took to transmit its first claim code,
+    # after it last became claimable, in seconds; or nil if it hasn't
+    # transmitted a code since.
+    #
+    def first_code_latency
+      latency = perform_request(REQUEST_TRANSMIT_LATENCY, 4).unpack("N").first
+      latency == NO_TRANSMIT_LATENCY ? nil : latency / 1_000_000.0
+    end
+
+    #
+    # Samples the board's clock, refining our estimate of its offset and drift
+    # from our own. Timestamps are exchanged with the board several times, and
+    # (as in NTP) only the exchange with the shortest round trip is kept, as
+    # it's the least distorted by USB latency. Each call adds one sample to
+    # the estimate, so calling this every few seconds tracks the board's drift.
+    # Returns the kept exchange's round-trip delay, in seconds.
+    #
+    def synchronize_clock(exchanges = CLOCK_SYNC_EXCHANGES)
+
+      delay, board_time, host_time = Array.new(exchanges) { exchange_timestamps }.min_by(&:first)
+
+      @clock_samples << [board_time, host_time]
+      @clock_samples.shift while @clock_samples.length > CLOCK_SAMPLE_HISTORY
+
+      delay
+
+    end
+
+    #
+    # Returns the amount by which our clock leads the board's, in seconds,
+    # as of the most recent synchronize_clock.
+    #
+    def clock_offset
+      raise ClockNotSynchronizedError if @clock_samples.empty?
+
+      board_time, host_time = @clock_samples.last
+      host_time - board_time
+    end
+
+    #
+    # Returns the rate at which the board's clock drifts from ours, as the
+    # number of seconds our clock gains for each second of the board's: the
+    # least-squares slope of our clock against the board's, less one. Two
+    # or more calls to synchronize_clock are needed; until then, this is zero.
+    #
+    def clock_drift
+
+      return 0.0 if @clock_samples.length < 2
+
+      board_mean = @clock_samples.map(&:first).reduce(:+) / @clock_samples.length
+      host_mean  = @clock_samples.map(&:last).reduce(:+) / @clock_samples.length
+
+      covariance = @clock_samples.map { |board, host| (board - board_mean) * (host - host_mean) }.reduce(:+)
+      variance   = @clock_samples.map { |board, _| (board - board_mean) ** 2 }.reduce(:+)
+
+      covariance / variance - 1
+
+    end
+
+    #
+    # Converts a time on the board's clock, in seconds since it started (such
+    # as ClaimEvent#time), into the equivalent time on our clock. This allows
+    # events from different boards to be placed in order.
+    #
+    def host_time(board_time)
+
+      raise ClockNotSynchronizedError if @clock_samples.empty?
+
+      #Work from the most recent sample, correcting for the drift since.
+      reference_board_time, reference_host_time = @clock_samples.last
+      Time.at(reference_host_time + (board_time - reference_board_time) * (1 + clock_drift))
+
+    end
+
+    #
+    # Converts a time on our clock into the equivalent time on the board's
+    # clock, in seconds since the board started; the inverse of host_time.
+    #
+    def board_time(host_time)
+
+      raise ClockNotSynchronizedError if @clock_samples.empty?
+
+      reference_board_time, reference_host_time = @clock_samples.last
+      reference_board_time + (host_time.to_f - reference_host_time) / (1 + clock_drift)
+
+    end
+
+    #
+    # Schedules a change to the given mode (see State::MODES), which the board
+    # will make by itself at the given time on our clock. This requires a prior
+    # synchronize_clock. Boards armed with the same time change mode together,
+    # to within their clocks' synchronization; the rest of each board's state
+    # is kept. Any change to the board's mode in the meantime cancels the
+    # scheduled change, as does scheduling another.
+    #
+    def schedule_mode(mode, at)
+
+      milliseconds = (board_time(at) * 1000).round
+      request = [State::MODES.fetch(mode), milliseconds & 0xFFFFFFFF].pack("CN")
+
+      response = State.read(perform_request(REQUEST_SCHEDULE_MODE, 1, request))
+      raise ScheduleError, "the board could not schedule a change to #{mode}" if response.mode == :error
+
+      response
+
+    end
+
+    #
+    # Sets the rate at which the board signals over IR, in baud; this must
+    # be one of IR_BAUD_RATES. The robots must signal at the same rate.
+    #
+    def ir_baud_rate=(rate)
+      set_parameter(:ir_baud_rate, rate)
+    end
+
+    #
+    # Selects the fastest IR signaling rate at which the fraction of bytes
+    # the board receives with framing errors stays below maximum_error_rate,
+    # and leaves the board at that rate. Each rate is tried in turn, fastest
+    # first: after allowing settle_time seconds for the other end to follow,
+    # the bytes received over trial_length seconds are counted. A rate at
+    # which fewer than minimum_bytes arrive doesn't qualify. If no rate
+    # qualifies, the board is left at the slowest.
+    #
+    # This requires something at the other end of the link which follows the
+    # board's rate, such as the responder firmware. Note that this reads
+    # (and thus clears) the board's counters. Returns the selected rate.
+    #
+    def negotiate_ir_baud(maximum_error_rate = 0.05, trial_length = 5, minimum_bytes = 3, settle_time = 3)
+
+      IR_BAUD_RATES.reverse_each do |rate|
+
+        #Switch to the rate, and discard anything counted while the
+        #other end catches up...
+        self.ir_baud_rate = rate
+        sleep settle_time
+        counters
+
+        #... then listen for a while.
+        sleep trial_length
+        trial    = counters
+        received = trial[:ir_bytes_received]
+
+        return rate if received >= minimum_bytes && trial[:ir_framing_errors] < maximum_error_rate * received
+
+      end
+
+      self.ir_baud_rate = IR_BAUD_RATES.first
+
+    end
+
+    #
+    # Returns the board's performance counters as a hash, which maps each
+    # counter's name (see COUNTER_NAMES) to the number of times the relevant
+    # event has occurred since the last call. The board's counters are cleared.
+    #
+    def counters
+
+      #Request the counters; the board first reports how many it has.
+      response = request_stream(REQUEST_COUNTERS)
+      count    = response.read(1).unpack("C").first
+      values   = response.read(count * 2).unpack("n*")
+
+      name_counters(values)
+
+    end
+
+    #
+    # Returns every claim attempt the board has logged since the last call,
+    # as a ClaimHistory: its events (oldest first), and the number of events
+    # lost because the board's log filled before it was read. The board's
+    # log is emptied.
+    #
+    def claim_history
+      ClaimHistory.read(request_stream(REQUEST_CLAIM_HISTORY))
+    end
+
+    #
+    # Returns the time the board has spent in each of its main interrupt
+    # handlers since the last call, as a hash which maps each handler's name
+    # (see PROFILED_ISR_NAMES) to a hash of its call count and its minimum,
+    # maximum, and total duration in CPU cycles. The board's profiles are
+    # cleared.
+    #
+    # The hash is empty unless the board's firmware was built with
+    # ISR_PROFILING enabled.
+    #
+    def isr_profile
+
+      #Request the profiles; the board first reports how many it has...
+      response = request_stream(REQUEST_ISR_PROFILE)
+      count    = response.read(1).unpack("C").first
+      profiles = response.read(count * 10).unpack("nnnN" * count).each_slice(4)
+
+      #... and pair each with its name.
+      Hash[profiles.each_with_index.map do |(calls, min, max, total), index|
+        [PROFILED_ISR_NAMES[index] || index, {
+          :calls        => calls,
+          :min_cycles   => calls.zero? ? nil : min,
+          :max_cycles   => calls.zero? ? nil : max,
+          :total_cycles => total
+        }]
+      end]
+
+    end
+
+    #
+    # Sends a request (as for perform_request) without waiting for its
+    # response. The request is tagged, so its response can be told apart
+    # from those of any other requests in flight; returns the tag, with
+    # which the response can be collected by receive_response.
+    #
+    def submit_request(request_code, transmit = nil)
+
+      tag = allocate_tag
+
+      #Send the tag, followed by the request itself, and any content.
+      @serial_port.write([REQUEST_TAGGED, tag, request_code].pack("CCC"))
+      @serial_port.write(transmit) if transmit
+
+      @outstanding_tags << tag
+      tag
+
+    end
+
+    #
+    # Waits for the response to the tagged request with the given tag,
+    # and returns it, as a binary string. Any responses to other requests
+    # which arrive first are kept until they're asked for.
+    #
+    def receive_response(tag)
+
+      raise ArgumentError, "no request is waiting on the tag #{tag}" unless @outstanding_tags.include?(tag)
+
+      receive_tagged_response until @tagged_responses.has_key?(tag)
+
+      @outstanding_tags.delete(tag)
+      @tagged_responses.delete(tag)
+
+    end
+
+    #
+    # Performs several requests at once, without waiting for each response
+    # before sending the next request. Each request is given as an array of
+    # its request code and any content (as for perform_request). Returns
+    # the responses, in the order the requests were given.
+    #
+    def perform_requests(*requests)
+      tags = requests.map { |request_code, transmit| submit_request(request_code, transmit) }
+      tags.map { |tag| receive_response(tag) }
+    end
+
+    #
+    # Selects the events (see EVENTS) which the board pushes to us as they
+    # happen, so we needn't keep polling it; e.g. [:state_changed] to hear of
+    # every change of owner. An empty list turns events off. Events are
+    # collected by process_events.
+    #
+    # Events can't be told apart from the responses to untagged requests;
+    # so while any are selected, every request is tagged.
+    #
+    def events=(types)
+
+      mask = types.map { |type| 1 << EVENTS.fetch(type) }.reduce(0, :|)
+
+      #Start tagging requests before the board can send any events,
+      #and stop only once it's no longer sending them.
+      @events_enabled = true
+      set_parameter(:events, mask)
+      @events_enabled = !mask.zero?
+
+    end
+
+    #
+    # Registers a block which is called with each Event the board pushes to
+    # us, as it's processed by process_events.
+    #
+    def on_event(&handler)
+      @event_handlers << handler
+    end
+
+    #
+    # Returns true iff the board has pushed events to us which
+    # haven't yet been processed; see process_events.
+    #
+    def events_pending?
+      !@pending_events.empty?
+    end
+
+    #
+    # Collects any events the board has pushed to us, waiting up to the given
+    # number of seconds for one to arrive (or indefinitely, if nil), and passes
+    # each to the blocks registered with on_event. Returns the events, oldest
+    # first; which is empty if none arrived in time.
+    #
+    def process_events(timeout = 0)
+
+      #If we haven't already received an event, wait for one...
+      receive_tagged_response if @pending_events.empty? && IO.select([@serial_port], nil, nil, timeout)
+
+      #... and collect any others that have arrived.
+      receive_tagged_response while IO.select([@serial_port], nil, nil, 0)
+
+      events, @pending_events = @pending_events, []
+      events.each { |event| @event_handlers.each { |handler| handler[event] } }
+
+    end
+
     
     private
 
@@ -191,6 +742,14 @@ module JDBeacon
 
       #TODO: Look up the request, if the request_code is a symbol.
 
+      #While the board is pushing events to us, its responses can only be
+      #told apart from them if they're tagged; the whole response is returned.
+      return receive_response(submit_request(request_code, transmit)) if @events_enabled
+
+      #Untagged responses can't be told apart from tagged ones; so collect
+      #the responses to any tagged requests that are still in flight.
+      receive_tagged_response until (@outstanding_tags - @tagged_responses.keys).empty?
+
       #Send the request identifier...
       send_state(State.new(:mode => request_code))
 
@@ -202,6 +761,116 @@ module JDBeacon
 
     end
 
+    #
+    # Performs a request (as for perform_request) whose response is of
+    # variable length, and returns an IO from which it can be read.
+    #
+    def request_stream(request_code, transmit = nil)
+
+      #Tagged responses arrive whole...
+      return StringIO.new(perform_request(request_code, 0, transmit)) if @events_enabled
+
+      #... but others are read from the board as they're needed.
+      perform_request(request_code, 0, transmit)
+      @serial_port
+
+    end
+
+    #
+    # Receives a single response to a tagged request: its tag, its length,
+    # and the response itself, which is kept until it's asked for. Events
+    # are framed the same way, and are kept until they're processed.
+    #
+    def receive_tagged_response
+
+      tag, length = @serial_port.read(2).unpack("CC")
+      response = length > 0 ? @serial_port.read(length) : ''
+
+      if tag == EVENT_TAG
+        @pending_events << parse_event(response)
+      else
+        @tagged_responses[tag] = response
+      end
+
+    end
+
+    #
+    # Converts the content of an event frame (its type, then its data)
+    # into an Event.
+    #
+    def parse_event(frame)
+
+      number, data = frame.unpack("Ca*")
+      type = EVENTS.key(number) || number
+
+      data =
+        case type
+        when :state_changed then State.read(data)
+        when :claim_attempt then ClaimEvent.read(data)
+        else data
+        end
+
+      Event.new(self, type, data)
+
+    end
+
+    #
+    # Returns a tag for a new tagged request, which isn't in use by any
+    # request still in flight.
+    #
+    def allocate_tag
+
+      raise Error, "too many requests are in flight" if @outstanding_tags.length >= EVENT_TAG
+
+      @next_tag = (@next_tag + 1) % EVENT_TAG while @outstanding_tags.include?(@next_tag)
+      tag, @next_tag = @next_tag, (@next_tag + 1) % EVENT_TAG
+      tag
+
+    end
+
+    #
+    # Pairs each of the given counter values with its name. Any counters
+    # added by newer firmware are reported by number.
+    #
+    def name_counters(values)
+      Hash[values.each_with_index.map { |value, index| [COUNTER_NAMES[index] || index, value] }]
+    end
+
+    #
+    # Performs a single timestamp exchange with the board. Returns the round
+    # trip's delay, less the time the board took to respond, along with the
+    # midpoints of the exchange on the board's clock and on ours, in seconds.
+    #
+    def exchange_timestamps
+
+      sent_at = Time.now.to_f
+      response = perform_request(REQUEST_TIME_SYNC, 12)
+      received_at = Time.now.to_f
+
+      #The board reports when our request arrived, and when it responded.
+      request_ms, request_us, response_ms, response_us = response.unpack("NnNn")
+      request_arrived_at = request_ms / 1000.0 + request_us / 1_000_000.0
+      response_sent_at = response_ms / 1000.0 + response_us / 1_000_000.0
+
+      delay = (received_at - sent_at) - (response_sent_at - request_arrived_at)
+      [delay, (request_arrived_at + response_sent_at) / 2, (sent_at + received_at) / 2]
+
+    end
+
+    #
+    # Sends the given state to the board (which may be a request, such as
+    # NULL_REQUEST), and returns the board's state in response.
+    #
+    def exchange_state(state)
+
+      #While events are enabled, the state is sent as a tagged request.
+      return State.read(receive_response(submit_request(state.to_binary_s.unpack("C").first))) if @events_enabled
+
+      send_state(state)
+      receive_state
+
+    end
+
     #
     # Sets the target beacon's state,
     # but does not wait for a response.
@@ -0,0 +1,78 @@
+require 'bindata'
+
+module JDBeacon
+
+  #
+  # Data structure which represents a single attempt to claim a beacon,
+  # in the binary format used by the beacon board's claim log.
+  #
+  class ClaimEvent < BinData::Record
+    endian :big
+
+    # The rate at which the board's timer ticks, which is
+    # the unit of each event's timestamp.
+    TICKS_PER_SECOND = 15625.0
+
+    # The time at which the attempt was received, in board timer ticks.
+    uint32 :timestamp
+
+    # The byte received from the robot.
+    uint8 :value
+
+    # Flags which describe the attempt; see framing_error?, accepted?, and throttled?.
+    uint8 :flags
+
+    # The number of bits by which the value differed from the expected response.
+    uint8 :distance
+
+    #
+    # Returns true iff the byte was received with a framing error.
+    #
+    def framing_error?
+      flags & 0x01 != 0
+    end
+
+    #
+    # Returns true iff the attempt successfully claimed the beacon.
+    #
+    def accepted?
+      flags & 0x02 != 0
+    end
+
+    #
+    # Returns true iff the attempt was ignored, because the robots had
+    # been attempting to claim the beacon too quickly.
+    #
+    def throttled?
+      flags & 0x04 != 0
+    end
+
+    #
+    # Returns the time at which the attempt was received, in seconds
+    # since the board started.
+    #
+    def time
+      timestamp / TICKS_PER_SECOND
+    end
+
+  end
+
+  #
+  # Data structure which represents the contents of a beacon board's claim log,
+  # as returned in response to a claim history request.
+  #
+  class ClaimHistory < BinData::Record
+
+    # The number of events which follow.
+    uint8 :event_count, :value => lambda { events.length }
+
+    # The number of events which were lost because the board's log filled
+    # before it was read.
+    uint8 :dropped
+
+    # The events themselves, oldest first.
+    array :events, :type => :claim_event, :initial_length => :event_count
+
+  end
+
+end
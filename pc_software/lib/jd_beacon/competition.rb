@@ -35,6 +35,23 @@ module JDBeacon
   #
   class Competition
 
+    # The length of the frame in which each beacon on the field transmits its
+    # claim codes in its own slot, in seconds. Each slot must be long enough
+    # for a full burst of claim codes.
+    TRANSMIT_FRAME_LENGTH = 1.0
+
+    # How often the beacons' transmit frames are realigned, in seconds.
+    TRANSMIT_FRAME_RESYNC_INTERVAL = 10
+
+    # How long before the start and end of a round the beacons are armed to
+    # change mode, in seconds. This must leave time to synchronize and arm
+    # every beacon on the field.
+    MODE_CHANGE_LEAD_TIME = 2
+
+    # The longest the game loop waits for a beacon to report a change, before
+    # checking whether any of its other work is due, in seconds.
+    EVENT_WAIT_INTERVAL = 0.1
+
     #This is for debug only!
     #attr_reader :board_pairs
  
@@ -188,48 +205,118 @@ module JDBeacon
     # This will lock the current thread.
     #
     # @param duration Duration in seconds.
+    # @param countdown The number of seconds for which the beacons should
+    #   pulse before the round starts; or zero to start immediately.
     #
-    def run!(duration = 180)
+    def run!(duration = 180, countdown = 0)
 
       reset
-      each_beacon { |beacon| beacon.mode = :on }
-      log("New competition round started. All ownership reset.")
 
+      #If requested, let the field know the round is about to start.
+      if countdown > 0
+        each_beacon { |beacon| beacon.mode = :countdown }
+        log("Round starting in #{countdown} seconds.")
+        sleep countdown
+      end
+
+      #Give each beacon its own transmit slot, so no two beacons' claim codes
+      #collide at a robot's receiver.
+      assign_transmit_slots
+
+      #Start every beacon at the same instant, rather than one after another.
+      start_time = Time.now + MODE_CHANGE_LEAD_TIME
+      schedule_mode_for_all(:on, start_time)
+      sleep [start_time - Time.now, 0].max
+      log("New competition round started. All ownership reset.")
 
       #And determine the finish time, if a duration is provided.
-      @finish_time = duration ? (Time.now + duration) : nil
+      @finish_time = duration ? (start_time + duration) : nil
+      freeze_scheduled = false
+
+      #Have each beacon tell us whenever its state changes, so we only need
+      #to look at a pair once one of its beacons has been claimed; then catch
+      #any claim made before the beacons could tell us.
+      each_beacon { |beacon| beacon.events = [:state_changed] }
+      Thread.exclusive { update_all_states }
 
       #Main game loop, which should run until the duration is passed.
       until time_up?
 
+        #Wait for a beacon to report a change (or for our other work to come due).
+        changed_beacons = wait_for_changes(EVENT_WAIT_INTERVAL)
+
         #Ensure that this thread is run exlcusively; and not interrupted.
         Thread.exclusive do
 
           #TODO: Keep track of score.
 
-          #Monitor each pair, as quickly as possible.
-          each_pair_with_index do |pair, pair_number|
-           
-            #Determine the current state of the given pair...
-            new_state  = states_for_pair(pair)
-            last_state = @last_states[pair_number]
+          #Keep the beacons' transmit slots aligned, as their clocks drift.
+          synchronize_transmit_slots if transmit_slots_need_synchronization?
 
-            #Update the boards according to any changes that have occurred;
-            #and update the most recent state accordingly.
-            @last_states[pair_number] = update_states_for_pair(pair, new_state, last_state)
+          #Shortly before time is up, arm every beacon to freeze at the same
+          #instant, so none can be claimed after the round ends.
+          if @finish_time && !freeze_scheduled && seconds_left < MODE_CHANGE_LEAD_TIME
+            schedule_mode_for_all(:frozen, @finish_time)
+            freeze_scheduled = true
+          end
 
-          end  
+          #Update any pair in which a beacon has changed.
+          update_changed_pairs(changed_beacons)
         end
       end
 
-      #Freeze all beacon activity, once the round is over!
-      each_beacon { |beacon| beacon.mode = :freeze }
+      #Freeze all beacon activity, once the round is over! The beacons have
+      #already frozen themselves, if the round had a limit; this only catches
+      #any beacon we un-froze by updating its owner just as time ran out.
+      Thread.exclusive { update_all_states }
+      each_beacon { |beacon| beacon.mode = :frozen }
+      each_beacon { |beacon| beacon.events = [] }
 
       log("Competition round ended!")
       log("Final scores: #{scores}.")
 
     end
 
+    #
+    # Divides a transmit frame of the given length (in seconds) into equal
+    # slots, one for each beacon on the field, and gives each beacon its slot.
+    #
+    def assign_transmit_slots(frame_length = TRANSMIT_FRAME_LENGTH)
+
+      slot_length = frame_length / beacons.count
+
+      @transmit_frame_length     = frame_length
+      @transmit_frame_started_at = Time.now
+
+      beacons.each_with_index do |beacon, index|
+        beacon.transmit_frame = frame_length
+        beacon.transmit_slot  = index * slot_length
+      end
+
+      synchronize_transmit_slots
+
+    end
+
+    #
+    # Aligns each beacon's transmit frames with our own clock.
+    #
+    def synchronize_transmit_slots
+      each_beacon { |beacon| beacon.synchronize_transmit_frame(@transmit_frame_started_at, @transmit_frame_length) }
+      @transmit_slots_synchronized_at = Time.now
+    end
+
+    #
+    # Schedules every beacon on the field to change to the given mode at the
+    # given time, so the whole field changes at once. Each beacon's clock is
+    # synchronized with ours first.
+    #
+    def schedule_mode_for_all(mode, at)
+      each_beacon do |beacon|
+        beacon.synchronize_clock
+        beacon.schedule_mode(mode, at)
+      end
+    end
+
     #
     # Returns the number of seconds remaining, which may be negative,
     # or nil if the round has no limit.
@@ -321,6 +408,65 @@ module JDBeacon
       {:red => pair[:red].state, :green => pair[:green].state }
     end
 
+    #
+    # Reads the current state of each pair of beacons, and updates the boards
+    # according to any claims that have occurred.
+    #
+    # Warning: This method updates beacon states, and thus should only be called in "exclusive"
+    # critical sections, to ensure thread safety.
+    #
+    def update_all_states
+      each_pair_with_index do |pair, pair_number|
+
+        #Determine the current state of the given pair...
+        new_state  = states_for_pair(pair)
+        last_state = @last_states[pair_number]
+
+        #Update the boards according to any changes that have occurred;
+        #and update the most recent state accordingly.
+        @last_states[pair_number] = update_states_for_pair(pair, new_state, last_state)
+
+      end
+    end
+
+    #
+    # Waits up to the given number of seconds for any beacon to report a change
+    # of state, and returns the beacons which have. Each beacon's events are
+    # consumed.
+    #
+    def wait_for_changes(timeout)
+
+      #Beacons may have reported changes while we were busy with other requests;
+      #only wait if none have.
+      ready = beacons.select(&:events_pending?)
+      ready = (IO.select(beacons, nil, nil, timeout) || [[]]).first if ready.empty?
+
+      ready.select { |beacon| beacon.process_events.any? { |event| event.type == :state_changed } }
+
+    end
+
+    #
+    # Reads the current state of each pair which contains one of the given
+    # beacons, and updates the boards according to any claims that have occurred.
+    #
+    # Warning: This method updates beacon states, and thus should only be called in "exclusive"
+    # critical sections, to ensure thread safety.
+    #
+    def update_changed_pairs(changed_beacons)
+      each_pair_with_index do |pair, pair_number|
+        next unless pair.values.any? { |beacon| changed_beacons.include?(beacon) }
+        @last_states[pair_number] = update_states_for_pair(pair, states_for_pair(pair), @last_states[pair_number])
+      end
+    end
+
+    #
+    # Returns true iff the beacons' transmit slots were assigned, and it's
+    # time to realign them.
+    #
+    def transmit_slots_need_synchronization?
+      @transmit_slots_synchronized_at && (Time.now - @transmit_slots_synchronized_at) > TRANSMIT_FRAME_RESYNC_INTERVAL
+    end
+
     #
     # 
     #
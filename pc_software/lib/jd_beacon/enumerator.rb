@@ -22,13 +22,22 @@ module JDBeacon
 
     #
     # Retreives the first enumerator which is appropriate for the
-    # current platform.
+    # current platform. Enumerators which ask to be preferred (such as
+    # the virtual beacon enumerator) take precedence over all others.
     #
     def self.for_current_platform
-      enumerator = @enumerators.find(&:supported?) || self
+      enumerator = @enumerators.find(&:preferred?) || @enumerators.find(&:supported?) || self
       enumerator.new
     end
 
+    #
+    # Returns true iff this enumerator should be used in preference to
+    # any platform enumerators. By default, enumerators are not preferred.
+    #
+    def self.preferred?
+      false
+    end
+
     #
     # Returns a list of serial ports to which beacon boards are connected.
     #
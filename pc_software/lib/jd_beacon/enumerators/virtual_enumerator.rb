@@ -0,0 +1,39 @@
+require 'jd_beacon/enumerator'
+
+module JDBeacon
+  module Enumerators
+
+    #
+    # Beacon board enumerator for "virtual" beacons: host-native builds of the
+    # board software (see board_software/host), whose serial ports are pseudo-terminals.
+    #
+    # This enumerator is used whenever the JD_BEACON_VIRTUAL environment variable is
+    # set to a glob which matches the virtual boards' terminals, such as the links
+    # created by virtual_beacon's -u option (e.g. "/tmp/beacons/*").
+    #
+    class VirtualEnumerator < Enumerator
+
+      #
+      # Virtual beacons are only used when explicitly requested.
+      #
+      def self.supported?
+        !!ENV['JD_BEACON_VIRTUAL']
+      end
+
+      #
+      # If virtual beacons have been requested, use them instead of any physical boards.
+      #
+      def self.preferred?
+        supported?
+      end
+
+      #
+      # Returns a list of the pseudo-terminals for each of the virtual beacon boards.
+      #
+      def connected_beacon_boards
+        Dir.glob(ENV['JD_BEACON_VIRTUAL']).sort.map { |path| File.realpath(path) }
+      end
+
+    end
+  end
+end
@@ -3,5 +3,7 @@ module JDBeacon
 
   class Error < RuntimeError; end 
   class NotConnectedError < RuntimeError; end 
+  class ClockNotSynchronizedError < Error; end
+  class ScheduleError < Error; end
 
 end
@@ -25,6 +25,7 @@ module JDBeacon
       :off     => 0,
       :normal  => 1,
       :on      => 1,
+      :countdown => 2,
       :frozen  => 27,
       :error   => 31,
     }
@@ -0,0 +1,83 @@
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+# Copyright (c) 2014 Binghamton University
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+require 'jd_beacon'
+require 'io/console'
+require_relative '../support/virtual_field'
+
+#
+# Runs a virtual beacon (see board_software/host), and checks that it pushes
+# events to us as it's claimed. Requires a prior `make host`.
+#
+describe JDBeacon::Board, "events" do
+
+  before(:all) do
+    @field = JDBeacon::VirtualField.new if JDBeacon::VirtualField.available?
+  end
+
+  after(:all) do
+    @field.stop if @field
+  end
+
+  it "should report claim attempts and changes of owner as they happen" do
+
+    pending "the virtual beacon hasn't been built" unless JDBeacon::VirtualField.available?
+
+    board = JDBeacon::Board.new(@field.usb_path)
+    robot = File.open(@field.ir_path, 'r+').tap(&:raw!)
+
+    #Put the beacon in play, and accept any response from the robot.
+    board.state = JDBeacon::State.new(:mode => :on, :affiliation => :red, :owner => :none)
+    board.maximum_allowed_errors = 8
+
+    handled = []
+    board.on_event { |event| handled << event }
+    board.events = [:state_changed, :claim_attempt]
+
+    #Requests should still work while events are enabled...
+    expect(board.state.owner).to eq :none
+    expect(board.counters).to include :valid_claims
+
+    #... and a claim should be reported without our asking.
+    robot.write("\x00")
+    robot.flush
+
+    events = board.process_events(1)
+    events += board.process_events(1) if events.count < 2
+
+    expect(events.map(&:type)).to eq [:claim_attempt, :state_changed]
+    expect(events.first.data).to be_accepted
+    expect(events.last.data.owner).to eq :red
+    expect(handled).to eq events
+
+    #Once events are turned off, the board should stop sending them.
+    board.events = []
+    board.owner = :none
+    expect(board.process_events(0.5)).to be_empty
+    expect(board.owner).to eq :none
+
+  end
+
+end
@@ -0,0 +1,118 @@
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+# Copyright (c) 2014 Binghamton University
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+require 'jd_beacon'
+require 'io/console'
+require_relative '../support/virtual_field'
+
+#
+# Runs a full field of virtual beacons (see board_software/host), and checks
+# that no two of their claim code transmissions overlap once each has been
+# given its own transmit slot. Requires a prior `make host`.
+#
+describe JDBeacon::Competition, "transmit slots" do
+
+  # The number of beacons on the emulated field.
+  beacon_count = 20
+
+  # The time a single claim code spends on the air, at the default 300 baud.
+  claim_code_airtime = 10 / 300.0
+
+  # How long to listen to the field, in seconds.
+  listen_time = 3
+
+  before(:all) do
+
+    next unless JDBeacon::VirtualField.available?
+
+    @field = JDBeacon::VirtualField.new(beacon_count)
+
+    #Point the board enumerator at the field, for this spec only.
+    @previous_virtual_boards = ENV['JD_BEACON_VIRTUAL']
+    ENV['JD_BEACON_VIRTUAL'] = @field.usb_pattern
+
+  end
+
+  after(:all) do
+    next unless @field
+
+    @field.stop
+    ENV['JD_BEACON_VIRTUAL'] = @previous_virtual_boards
+  end
+
+  #
+  # Returns the time at which each claim code arrives over the given
+  # terminals, as a list of [time, terminal index] pairs.
+  #
+  def record_transmissions(terminals, duration)
+
+    transmissions = []
+    finish_time   = Time.now + duration
+
+    while Time.now < finish_time
+      ready, _, _ = IO.select(terminals, nil, nil, 0.01)
+
+      (ready || []).each do |terminal|
+        codes = terminal.read_nonblock(64)
+        codes.bytesize.times { transmissions << [Time.now, terminals.index(terminal)] }
+      end
+    end
+
+    transmissions
+
+  end
+
+  it "should keep every beacon's claim codes from colliding" do
+
+    pending "the virtual beacon hasn't been built" unless JDBeacon::VirtualField.available?
+
+    competition = JDBeacon::Competition.new
+    terminals   = (0...beacon_count).map { |index| File.open(@field.ir_path(index), 'r+').tap(&:raw!) }
+
+    #Give each beacon a slot, and let them all start transmitting.
+    competition.assign_transmit_slots
+    competition.each_beacon { |beacon| beacon.mode = :on }
+
+    #Discard anything sent before we started listening, as we can't tell when it arrived.
+    terminals.each do |terminal|
+      begin
+        terminal.read_nonblock(64)
+      rescue IO::WaitReadable
+      end
+    end
+    transmissions = record_transmissions(terminals, listen_time)
+
+    #Each beacon should transmit once per frame...
+    counts = transmissions.group_by(&:last).values.map(&:count)
+    expect(counts.count).to eq beacon_count
+    expect(counts.min).to be >= listen_time - 1
+
+    #... and no beacon's code should be on the air while another's is.
+    gaps = transmissions.each_cons(2).reject { |(_, a), (_, b)| a == b }.map { |(first, _), (second, _)| second - first }
+    expect(gaps.min).to be > claim_code_airtime
+
+  end
+
+end
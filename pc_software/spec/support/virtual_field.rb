@@ -0,0 +1,99 @@
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2014 Kyle J. Temkin <ktemkin@binghamton.edu>
+# Copyright (c) 2014 Binghamton University
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+require 'tmpdir'
+require 'fileutils'
+
+module JDBeacon
+
+  #
+  # A field of virtual beacons (see board_software/host), each running as its
+  # own process, with its USB and IR terminals in a temporary directory. Used
+  # by the specs and benchmarks; requires a prior `make host`.
+  #
+  class VirtualField
+
+    # The virtual beacon executable.
+    EXECUTABLE = File.expand_path('../../../../board_software/host/virtual_beacon', __FILE__)
+
+    # How long to give the beacons to come up, once their terminals exist.
+    STARTUP_TIME = 1
+
+    attr_reader :directory
+
+    #
+    # Returns true iff the virtual beacon has been built.
+    #
+    def self.available?(executable = EXECUTABLE)
+      File.executable?(executable)
+    end
+
+    #
+    # Starts the given number of virtual beacons, and waits for them to come up.
+    #
+    def initialize(count = 1, executable = EXECUTABLE)
+
+      @directory = Dir.mktmpdir('jd_beacon')
+      @pids = (0...count).map do |index|
+        spawn(executable, '-u', usb_path(index), '-i', ir_path(index), :out => File::NULL)
+      end
+
+      sleep 0.1 until Dir.glob("#{@directory}/*").count == 2 * count
+      sleep STARTUP_TIME
+
+    end
+
+    #
+    # Returns the path to the USB terminal of the beacon with the given index.
+    #
+    def usb_path(index = 0)
+      "#{@directory}/usb%02d" % index
+    end
+
+    #
+    # Returns the path to the IR terminal of the beacon with the given index.
+    #
+    def ir_path(index = 0)
+      "#{@directory}/ir%02d" % index
+    end
+
+    #
+    # Returns a glob which matches every beacon's USB terminal.
+    #
+    def usb_pattern
+      "#{@directory}/usb*"
+    end
+
+    #
+    # Stops each of the beacons, and removes their terminals.
+    #
+    def stop
+      @pids.each { |pid| Process.kill('TERM', pid); Process.wait(pid) }
+      FileUtils.remove_entry(@directory)
+    end
+
+  end
+
+end